@@ -20,545 +20,6221 @@
 #ifndef ASYNC_WRAPPER_HPP_
 #define ASYNC_WRAPPER_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
 #include <type_traits>
 #include <future>
+#include <thread>
 #include <tuple>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // defined(__linux__)
 #if defined(ENABLE_CO_AWAIT)
-#include <experimental/coroutine>
+#include <coroutine>
 #endif // defined(ENABLE_CO_AWAIT)
+#if defined(ENABLE_INSTRUMENTATION)
+#include <cstdio>
+#include <ostream>
+#include <string>
+#endif // defined(ENABLE_INSTRUMENTATION)
 
 namespace cue {
 
+template <typename _Ty>
+class recycling_allocator;
+
+namespace detail {
+
+struct placeholder_std_future_t final {};
+
+struct placeholder_awaitable_t final {};
+
+struct placeholder_awaitable_st_t final {};
+
+struct placeholder_continuable_t final {};
+
+struct placeholder_blocking_t final {
+    // upper bound of the adaptive spin before a waiter sleeps, 0 sleeps right away
+    std::uint32_t max_spins;
+};
+
+struct placeholder_deferred_t final {};
+
+struct inline_if_running_t final {};
+
+// stands for the void* user data of a C callback, not a placeholder of its own
+struct placeholder_user_data_t final {};
+
+// _Executor is a reference when awaitable_on was given an lvalue
+template <typename _Executor, bool _Inline>
+struct placeholder_awaitable_on_t final {
+    _Executor executor;
+};
+
+template <typename _Ty>
+struct is_placeholder : std::false_type {};
+
+template <>
+struct is_placeholder<placeholder_std_future_t> : std::true_type {};
+
+template <>
+struct is_placeholder<placeholder_awaitable_t> : std::true_type {};
+
+template <>
+struct is_placeholder<placeholder_awaitable_st_t> : std::true_type {};
+
+template <>
+struct is_placeholder<placeholder_continuable_t> : std::true_type {};
+
+template <>
+struct is_placeholder<placeholder_blocking_t> : std::true_type {};
+
+template <>
+struct is_placeholder<placeholder_deferred_t> : std::true_type {};
+
+template <typename _Executor, bool _Inline>
+struct is_placeholder<placeholder_awaitable_on_t<_Executor, _Inline>> : std::true_type {};
+
+// intrusive reference count of a heap allocated completion state
+class shared_state_base {
+public:
+    shared_state_base() noexcept = default;
+    shared_state_base(const shared_state_base&) = delete;
+    shared_state_base& operator=(const shared_state_base&) = delete;
+
+    void add_ref() noexcept {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+    }
+
+protected:
+    virtual ~shared_state_base() = default;
+
+    virtual void destroy() noexcept = 0;
+
+private:
+    std::atomic<std::uint32_t> refs_{1};
+};
+
+// in debug builds, asserts that every access comes from the thread that created the object
+class thread_affinity {
+protected:
+#if defined(NDEBUG)
+    void check_thread() const noexcept {
+    }
+#else
+    void check_thread() const noexcept {
+        assert(owner_ == std::this_thread::get_id() && "single thread state used from another thread");
+    }
+
+private:
+    std::thread::id owner_{std::this_thread::get_id()};
+#endif // defined(NDEBUG)
+};
+
+// shared_state_base for a completion state confined to one thread, plain increments and decrements
+class local_state_base : protected thread_affinity {
+public:
+    local_state_base() noexcept = default;
+    local_state_base(const local_state_base&) = delete;
+    local_state_base& operator=(const local_state_base&) = delete;
+
+    void add_ref() noexcept {
+        check_thread();
+        ++refs_;
+    }
+
+    void release() noexcept {
+        check_thread();
+        if (--refs_ == 0) {
+            destroy();
+        }
+    }
+
+protected:
+    virtual ~local_state_base() = default;
+
+    virtual void destroy() noexcept = 0;
+
+private:
+    std::uint32_t refs_{1};
+};
+
+// the copies of a call's callback that are alive and whether one of them was called, in one word.
+// the first call of any copy completes the call, the last copy dropped without a call breaks it.
+class callback_tally final {
+public:
+    void copy() noexcept {
+        word_.fetch_add(one_copy, std::memory_order_relaxed);
+    }
+
+    // true for the first call, or claim from outside, of all copies
+    bool fire() noexcept {
+        return !(word_.fetch_or(fired, std::memory_order_acq_rel) & fired);
+    }
+
+    // true if the last copy went away without a call, the call then counts as fired
+    bool drop() noexcept {
+        if (word_.fetch_sub(one_copy, std::memory_order_acq_rel) != one_copy) {
+            return false;
+        }
+        word_.store(fired, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t fired{1};
+    static constexpr std::uint32_t one_copy{2};
+
+    std::atomic<std::uint32_t> word_{one_copy};
+};
+
+// callback_tally of a state confined to one thread
+class local_callback_tally final {
+public:
+    void copy() noexcept {
+        ++copies_;
+    }
+
+    bool fire() noexcept {
+        return !std::exchange(fired_, true);
+    }
+
+    bool drop() noexcept {
+        return --copies_ == 0 && fire();
+    }
+
+private:
+    std::uint32_t copies_{1};
+    bool fired_{false};
+};
+
+// what a call completes with when its callback is dropped without being called
+inline std::exception_ptr broken_promise() {
+    return std::make_exception_ptr(std::future_error{std::future_errc::broken_promise});
+}
+
+// futex style wait on a 32 bit word, blocks while word == expected and may wake spuriously.
+// the raw futex is preferred on linux, some std::atomic::wait implementations stall on ping-pong
+// patterns like a producer and consumer handing over one slot at a time.
+inline void atomic_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) noexcept {
+#if defined(__linux__)
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)
+    word.wait(expected, std::memory_order_acquire);
+#else
+    while (word.load(std::memory_order_acquire) == expected) {
+        std::this_thread::yield();
+    }
+#endif
+}
+
+// atomic_wait giving up after timeout, the caller checks word and its deadline again
+inline void atomic_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                            std::chrono::nanoseconds timeout) noexcept {
+#if defined(__linux__)
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    const timespec relative{static_cast<time_t>(seconds.count()), static_cast<long>((timeout - seconds).count())};
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+#else
+    (void)word;
+    (void)expected;
+    (void)timeout;
+    std::this_thread::yield();
+#endif
+}
+
+// a spin loop iteration, lets the sibling hyperthread run
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+inline void atomic_notify_one(std::atomic<std::uint32_t>& word) noexcept {
+#if defined(__linux__)
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)
+    word.notify_one();
+#else
+    (void)word;
+#endif
+}
+
+inline void atomic_notify_all(std::atomic<std::uint32_t>& word) noexcept {
+#if defined(__linux__)
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#elif defined(__cpp_lib_atomic_wait)
+    word.notify_all();
+#else
+    (void)word;
+#endif
+}
+
+// std::future has no completion hook. a completion state holding a std::promise signals here once
+// it is gone, its future ready by then, and when_any on std::future sleeps until such a signal.
+// nothing maps a std::future back to its state, so a signal wakes every waiting when_any.
+class future_signal final {
+public:
+    static future_signal& instance() noexcept {
+        static future_signal signal;
+        return signal;
+    }
+
+    // one relaxed load without waiters. with no fence a waiter registering concurrently may be
+    // missed, the timeout of wait_for() bounds its sleep then.
+    void notify() noexcept {
+        if (waiters_.load(std::memory_order_relaxed)) {
+            epoch_.fetch_add(1, std::memory_order_release);
+            atomic_notify_all(epoch_);
+        }
+    }
+
+    // blocks until ready() or a signal, at most for timeout, which bounds the wait on futures that
+    // do not come from a completion state
+    template <typename _Ready>
+    void wait_for(_Ready&& ready, std::chrono::nanoseconds timeout) noexcept {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        const auto epoch = epoch_.load(std::memory_order_acquire);
+        if (!ready()) {
+            atomic_wait_for(epoch_, epoch, timeout);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    future_signal() noexcept = default;
+
+    std::atomic<std::uint32_t> epoch_{0};
+    std::atomic<std::uint32_t> waiters_{0};
+};
+
+template <typename _Promise>
+struct holds_std_promise : std::false_type {};
+
+template <typename _Ty>
+struct holds_std_promise<std::promise<_Ty>> : std::true_type {};
+
+// decorators such as limited_promise or expected_promise wrap the promise they complete first
+template <template <typename...> class _Decorator, typename _Promise, typename... _Rest>
+struct holds_std_promise<_Decorator<_Promise, _Rest...>> : holds_std_promise<_Promise> {};
+
+inline std::int64_t steady_now_ns() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+#if defined(ENABLE_INSTRUMENTATION)
+
+// small sequential id of the calling thread, for trace output
+inline std::uint32_t thread_index() noexcept {
+    static std::atomic<std::uint32_t> next{1};
+    static thread_local const std::uint32_t index{next.fetch_add(1, std::memory_order_relaxed)};
+    return index;
+}
+
+// log-linear histogram of nanoseconds, 8 linear buckets per power of two, so a bucket is at most
+// 12.5% wide. recording is one relaxed increment.
+class latency_histogram final {
+public:
+    static constexpr std::size_t sub_bits{3};
+    static constexpr std::size_t sub_count{1 << sub_bits};
+    static constexpr std::size_t max_exponent{47};
+    static constexpr std::size_t bucket_count{(max_exponent - sub_bits + 2) * sub_count};
+
+    void record(std::int64_t ns) noexcept {
+        buckets_[index_of(static_cast<std::uint64_t>(std::max<std::int64_t>(ns, 0)))].fetch_add(
+            1, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const noexcept {
+        std::uint64_t total{0};
+        for (auto& bucket : buckets_) {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // midpoint of the bucket holding the q-th quantile, 0 when empty
+    std::uint64_t quantile(double q) const noexcept {
+        const auto total = count();
+        if (!total) {
+            return 0;
+        }
+        const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        std::uint64_t seen{0};
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return (lower_bound(i) + lower_bound(i + 1)) / 2;
+            }
+        }
+        return lower_bound(bucket_count);
+    }
+
+private:
+    static std::size_t index_of(std::uint64_t ns) noexcept {
+        if (ns < sub_count) {
+            return static_cast<std::size_t>(ns);
+        }
+        std::size_t exponent{63};
+        while (!(ns >> exponent)) {
+            --exponent;
+        }
+        if (exponent > max_exponent) {
+            return bucket_count - 1;
+        }
+        const auto sub = static_cast<std::size_t>(ns >> (exponent - sub_bits)) & (sub_count - 1);
+        return (exponent - sub_bits + 1) * sub_count + sub;
+    }
+
+    static std::uint64_t lower_bound(std::size_t index) noexcept {
+        if (index < sub_count) {
+            return index;
+        }
+        const auto exponent = index / sub_count + sub_bits - 1;
+        return (sub_count + index % sub_count) << (exponent - sub_bits);
+    }
+
+    std::atomic<std::uint64_t> buckets_[bucket_count]{};
+};
+
+inline std::atomic<std::int64_t>& in_flight_calls() noexcept {
+    static std::atomic<std::int64_t> count{0};
+    return count;
+}
+
+// statistics of one callee, identified by its function pointer or its type
+struct call_site final {
+    call_site(const void* site_key, std::string site_name) : key{site_key}, name{std::move(site_name)} {
+    }
+
+    const void* key;
+    std::string name;
+    std::atomic<std::uint64_t> launched{0};
+    std::atomic<std::uint64_t> completed{0};
+    // the callback was destroyed without firing
+    std::atomic<std::uint64_t> abandoned{0};
+    latency_histogram latency;
+};
+
+// completed calls, overwritten round robin. slots are seqlocked so a dump never blocks writers.
+class trace_buffer final {
+public:
+    struct event final {
+        std::atomic<std::uint64_t> sequence{0};
+        std::atomic<const call_site*> site{nullptr};
+        std::atomic<std::int64_t> begin{0};
+        std::atomic<std::int64_t> end{0};
+        std::atomic<std::uint32_t> launch_thread{0};
+        std::atomic<std::uint32_t> complete_thread{0};
+    };
+
+    static constexpr std::size_t capacity{1 << 16};
+
+    static std::atomic_bool& enabled() noexcept {
+        static std::atomic_bool value{false};
+        return value;
+    }
+
+    static trace_buffer& instance() {
+        static auto buffer = new trace_buffer{};
+        return *buffer;
+    }
+
+    void push(const call_site* site, std::int64_t begin, std::int64_t end, std::uint32_t launch_thread) noexcept {
+        const auto index = next_.fetch_add(1, std::memory_order_relaxed);
+        auto& slot = events_[index & (capacity - 1)];
+        slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.site.store(site, std::memory_order_relaxed);
+        slot.begin.store(begin, std::memory_order_relaxed);
+        slot.end.store(end, std::memory_order_relaxed);
+        slot.launch_thread.store(launch_thread, std::memory_order_relaxed);
+        slot.complete_thread.store(thread_index(), std::memory_order_relaxed);
+        slot.sequence.store(index * 2 + 2, std::memory_order_release);
+    }
+
+    // calls func(site, begin, end, launch_thread, complete_thread) for every consistent slot
+    template <typename _Func>
+    void for_each(_Func&& func) const {
+        for (std::size_t i = 0; i < capacity; ++i) {
+            auto& slot = events_[i];
+            const auto sequence = slot.sequence.load(std::memory_order_acquire);
+            if (!sequence || (sequence & 1)) {
+                continue;
+            }
+            const auto site = slot.site.load(std::memory_order_relaxed);
+            const auto begin = slot.begin.load(std::memory_order_relaxed);
+            const auto end = slot.end.load(std::memory_order_relaxed);
+            const auto launch_thread = slot.launch_thread.load(std::memory_order_relaxed);
+            const auto complete_thread = slot.complete_thread.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                func(*site, begin, end, launch_thread, complete_thread);
+            }
+        }
+    }
+
+private:
+    trace_buffer() = default;
+
+    std::atomic<std::uint64_t> next_{0};
+    std::unique_ptr<event[]> events_{new event[capacity]};
+};
+
+// open addressed table of call sites, inserted with a CAS and never removed, so lookups take no
+// lock. sites beyond the table size share one overflow site.
+class call_site_registry final {
+public:
+    static constexpr std::size_t capacity{1024};
+
+    static call_site_registry& instance() {
+        static auto registry = new call_site_registry{};
+        return *registry;
+    }
+
+    // make_name is called only when key is new
+    template <typename _MakeName>
+    call_site* find(const void* key, _MakeName&& make_name) {
+        auto hash = (reinterpret_cast<std::uintptr_t>(key) >> 4) * 0x9e3779b97f4a7c15ull;
+        for (std::size_t probe = 0; probe < capacity; ++probe, ++hash) {
+            auto& slot = sites_[hash & (capacity - 1)];
+            auto site = slot.load(std::memory_order_acquire);
+            if (!site) {
+                std::unique_ptr<call_site> fresh{new call_site{key, make_name()}};
+                if (slot.compare_exchange_strong(site, fresh.get(), std::memory_order_acq_rel,
+                                                 std::memory_order_acquire)) {
+                    return fresh.release();
+                }
+            }
+            if (site->key == key) {
+                return site;
+            }
+        }
+        return &overflow_;
+    }
+
+    template <typename _Func>
+    void for_each(_Func&& func) const {
+        for (auto& slot : sites_) {
+            if (auto site = slot.load(std::memory_order_acquire)) {
+                func(*site);
+            }
+        }
+        if (overflow_.launched.load(std::memory_order_relaxed)) {
+            func(overflow_);
+        }
+    }
+
+private:
+    call_site_registry() = default;
+
+    std::atomic<call_site*> sites_[capacity]{};
+    call_site overflow_{nullptr, "(other)"};
+};
+
+// the type argument out of a compiler generated function signature
+inline std::string type_in_signature(const std::string& signature) {
+#if defined(_MSC_VER)
+    const auto begin = signature.find("type_name<") + 10;
+    const auto end = signature.rfind(">(");
+#else
+    const auto begin = signature.find("_Ty = ") + 6;
+    const auto end = signature.find_first_of(";]", begin);
+#endif
+    return begin < end && end != std::string::npos ? signature.substr(begin, end - begin) : signature;
+}
+
+// spelling of _Ty, no rtti needed
+template <typename _Ty>
+const std::string& type_name() {
+#if defined(_MSC_VER)
+    static const std::string name{type_in_signature(__FUNCSIG__)};
+#else
+    static const std::string name{type_in_signature(__PRETTY_FUNCTION__)};
+#endif
+    return name;
+}
+
+template <typename _Ty>
+struct type_key final {
+    static constexpr char value{0};
+};
+
+template <typename _Ty>
+constexpr char type_key<_Ty>::value;
+
+// functors and lambdas are keyed by type, found once per type
+template <typename _Func>
+call_site* call_site_of(const _Func&) {
+    static const auto site =
+        call_site_registry::instance().find(&type_key<_Func>::value, []() { return type_name<_Func>(); });
+    return site;
+}
+
+// function pointers of one signature share a type, so they are keyed by address
+template <typename _Ret, typename... _Args>
+call_site* call_site_of(_Ret (*func)(_Args...)) {
+    const auto key = reinterpret_cast<const void*>(func);
+    return call_site_registry::instance().find(key, [key]() {
+        char address[2 * sizeof(void*) + 8];
+        std::snprintf(address, sizeof(address), " at %p", key);
+        return type_name<_Ret (*)(_Args...)>() + address;
+    });
+}
+
+// one wrapped call, launched by async_wrapper and finished by the first completion of its
+// callback or, if that never fires, by the destruction of its state
+class call_record final {
+public:
+    void launch(call_site* site) noexcept {
+        site_ = site;
+        begin_ = steady_now_ns();
+        launch_thread_ = thread_index();
+        site->launched.fetch_add(1, std::memory_order_relaxed);
+        in_flight_calls().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void complete() noexcept {
+        if (!site_) {
+            return;
+        }
+        const auto end = steady_now_ns();
+        site_->latency.record(end - begin_);
+        site_->completed.fetch_add(1, std::memory_order_relaxed);
+        in_flight_calls().fetch_sub(1, std::memory_order_relaxed);
+        if (trace_buffer::enabled().load(std::memory_order_relaxed)) {
+            trace_buffer::instance().push(site_, begin_, end, launch_thread_);
+        }
+        site_ = nullptr;
+    }
+
+    void abandon() noexcept {
+        if (!site_) {
+            return;
+        }
+        site_->abandoned.fetch_add(1, std::memory_order_relaxed);
+        in_flight_calls().fetch_sub(1, std::memory_order_relaxed);
+        site_ = nullptr;
+    }
+
+private:
+    call_site* site_{nullptr};
+    std::int64_t begin_{0};
+    std::uint32_t launch_thread_{0};
+};
+#endif // defined(ENABLE_INSTRUMENTATION)
+
+// shared by a stop_source and its tokens. registrations are fired outside the lock, one at a time,
+// so remove() never waits for a running callback; the owner of a registration keeps it alive instead.
+class stop_state final {
+public:
+    struct registration {
+        void (*fire)(registration*);
+        registration* prev{nullptr};
+        registration* next{nullptr};
+    };
+
+    stop_state() noexcept {
+        head_.prev = &head_;
+        head_.next = &head_;
+    }
+
+    stop_state(const stop_state&) = delete;
+    stop_state& operator=(const stop_state&) = delete;
+
+    bool requested() const noexcept {
+        return requested_.load(std::memory_order_acquire);
+    }
+
+    // false if stop was requested already, node is not fired then
+    bool add(registration* node) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (requested_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        node->prev = &head_;
+        node->next = head_.next;
+        head_.next->prev = node;
+        head_.next = node;
+        return true;
+    }
+
+    // false if node fired or is firing
+    bool remove(registration* node) noexcept {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (!node->next) {
+            return false;
+        }
+        unlink(node);
+        return true;
+    }
+
+    bool request() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        if (requested_.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        while (head_.next != &head_) {
+            auto node = head_.next;
+            unlink(node);
+            lock.unlock();
+            node->fire(node);
+            lock.lock();
+        }
+        return true;
+    }
+
+private:
+    static void unlink(registration* node) noexcept {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = nullptr;
+        node->next = nullptr;
+    }
+
+    std::mutex mutex_;
+    registration head_{nullptr};
+    std::atomic_bool requested_{false};
+};
+
+template <typename _Promise>
+class cancellable_promise;
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+class awaitable_promise;
+
+struct awaitable_access;
+
+template <typename _Ty>
+class inline_call_scope;
+
+template <typename _Ty>
+class coroutine_promise;
+#endif // defined(ENABLE_CO_AWAIT)
+
+// a result constructed in place at most once, held by a future or promise itself
+template <typename _Ty>
+class inline_result final {
+public:
+    inline_result() noexcept = default;
+
+    inline_result(inline_result&& rhs) noexcept(std::is_nothrow_move_constructible<_Ty>{}) {
+        if (rhs.has_value_) {
+            emplace(std::move(rhs.value()));
+            rhs.reset();
+        }
+    }
+
+    inline_result& operator=(inline_result&& rhs) noexcept(std::is_nothrow_move_constructible<_Ty>{}) {
+        if (std::addressof(rhs) != this) {
+            reset();
+            if (rhs.has_value_) {
+                emplace(std::move(rhs.value()));
+                rhs.reset();
+            }
+        }
+        return *this;
+    }
+
+    ~inline_result() {
+        reset();
+    }
+
+    bool has_value() const noexcept {
+        return has_value_;
+    }
+
+    template <typename... _Args>
+    void emplace(_Args&&... args) {
+        ::new (static_cast<void*>(&storage_)) _Ty(std::forward<_Args>(args)...);
+        has_value_ = true;
+    }
+
+    _Ty take() {
+        return std::move(value());
+    }
+
+private:
+    _Ty& value() noexcept {
+        return *reinterpret_cast<_Ty*>(&storage_);
+    }
+
+    void reset() noexcept {
+        if (has_value_) {
+            value().~_Ty();
+            has_value_ = false;
+        }
+    }
+
+    typename std::aligned_storage<sizeof(_Ty), alignof(_Ty)>::type storage_;
+    bool has_value_{false};
+};
+
+template <>
+class inline_result<void> final {
+public:
+    inline_result() noexcept = default;
+
+    inline_result(inline_result&& rhs) noexcept : has_value_{rhs.has_value_} {
+        rhs.has_value_ = false;
+    }
+
+    inline_result& operator=(inline_result&& rhs) noexcept {
+        has_value_ = rhs.has_value_;
+        rhs.has_value_ = false;
+        return *this;
+    }
+
+    bool has_value() const noexcept {
+        return has_value_;
+    }
+
+    void emplace() noexcept {
+        has_value_ = true;
+    }
+
+    void take() noexcept {
+    }
+
+private:
+    bool has_value_{false};
+};
+
+} // namespace detail
+
+class stop_token {
+public:
+    stop_token() noexcept = default;
+
+    bool stop_requested() const noexcept {
+        return state_ && state_->requested();
+    }
+
+    bool stop_possible() const noexcept {
+        return state_ != nullptr;
+    }
+
+private:
+    friend class stop_source;
+
+    template <typename>
+    friend class detail::cancellable_promise;
+
+    explicit stop_token(std::shared_ptr<detail::stop_state> state) noexcept : state_{std::move(state)} {
+    }
+
+    std::shared_ptr<detail::stop_state> state_;
+};
+
+// cancels the wrapped calls given one of its tokens, see placeholder::with_stop_token
+class stop_source {
+public:
+    stop_source() : state_{std::make_shared<detail::stop_state>()} {
+    }
+
+    stop_token get_token() const noexcept {
+        return stop_token{state_};
+    }
+
+    // true if this call made the request, pending calls complete with std::errc::operation_canceled
+    bool request_stop() {
+        return state_->request();
+    }
+
+    bool stop_requested() const noexcept {
+        return state_->requested();
+    }
+
+private:
+    std::shared_ptr<detail::stop_state> state_;
+};
+
+namespace detail {
+
+// a caller waiting for a permit of an async_semaphore, queued in place without allocation
+struct semaphore_waiter {
+    void (*grant)(semaphore_waiter*);
+    std::atomic<semaphore_waiter*> next{nullptr};
+    std::int64_t since{0};
+};
+
+} // namespace detail
+
+// counting semaphore bounding the calls in flight, see placeholder::limited.
+// count_ holds the free permits, or minus the number of waiters. waiters are linked into an intrusive
+// MPSC queue in FIFO order. a release seeing waiters hands its permit to the oldest one directly; one
+// releaser at a time serves the handoffs, the others only add to its backlog, so no one blocks and a
+// call completing inline from a granted waiter does not recurse.
+class async_semaphore final {
+public:
+    struct stats_t final {
+        std::int64_t in_flight;
+        std::int64_t waiting;
+        std::uint64_t waits;
+        std::uint64_t total_wait_ns;
+        std::uint64_t max_wait_ns;
+    };
+
+    explicit async_semaphore(std::int64_t permits) noexcept : permits_{permits}, count_{permits} {
+    }
+
+    async_semaphore(const async_semaphore&) = delete;
+    async_semaphore& operator=(const async_semaphore&) = delete;
+
+    bool try_acquire() noexcept {
+        auto count = count_.load(std::memory_order_relaxed);
+        while (count > 0) {
+            if (count_.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // blocks the calling thread until it holds a permit
+    void acquire_blocking() {
+        struct waiter final : detail::semaphore_waiter {
+            waiter() noexcept : semaphore_waiter{&wake} {
+            }
+
+            static void wake(semaphore_waiter* node) {
+                auto self = static_cast<waiter*>(node);
+                // the waiter may return once it sees 2, so that is the last thing touched
+                self->granted.store(1, std::memory_order_release);
+                detail::atomic_notify_one(self->granted);
+                self->granted.store(2, std::memory_order_release);
+            }
+
+            std::atomic<std::uint32_t> granted{0};
+        };
+
+        waiter node;
+        if (acquire_or_wait(&node)) {
+            return;
+        }
+        for (;;) {
+            const auto granted = node.granted.load(std::memory_order_acquire);
+            if (granted == 2) {
+                return;
+            }
+            if (granted == 0) {
+                detail::atomic_wait(node.granted, 0);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+#if defined(ENABLE_CO_AWAIT)
+    class acquire_awaiter final : detail::semaphore_waiter {
+    public:
+        explicit acquire_awaiter(async_semaphore& semaphore) noexcept
+            : semaphore_waiter{&resume}, semaphore_{semaphore} {
+        }
+
+        bool await_ready() noexcept {
+            return semaphore_.try_acquire();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            handle_ = handle;
+            return !semaphore_.acquire_or_wait(this);
+        }
+
+        void await_resume() const noexcept {
+        }
+
+    private:
+        static void resume(semaphore_waiter* node) {
+            static_cast<acquire_awaiter*>(node)->handle_.resume();
+        }
+
+        async_semaphore& semaphore_;
+        std::coroutine_handle<> handle_;
+    };
+
+    // co_await semaphore.acquire() suspends until a permit is handed over, on the releasing thread
+    acquire_awaiter acquire() noexcept {
+        return acquire_awaiter{*this};
+    }
+#endif // defined(ENABLE_CO_AWAIT)
+
+    // true with a permit taken, otherwise waiter->grant runs once one is handed over
+    bool acquire_or_wait(detail::semaphore_waiter* waiter) noexcept {
+        if (count_.fetch_sub(1, std::memory_order_acquire) > 0) {
+            return true;
+        }
+        waiter->since = detail::steady_now_ns();
+        push(waiter);
+        return false;
+    }
+
+    void release() noexcept {
+        if (count_.fetch_add(1, std::memory_order_release) >= 0) {
+            return;
+        }
+        // a waiter counted itself, it gets this permit from whoever serves the handoffs
+        if (handoffs_.fetch_add(1, std::memory_order_acq_rel) != 0) {
+            return;
+        }
+        for (;;) {
+            auto waiter = pop();
+            const auto waited = static_cast<std::uint64_t>(detail::steady_now_ns() - waiter->since);
+            waits_.fetch_add(1, std::memory_order_relaxed);
+            total_wait_ns_.fetch_add(waited, std::memory_order_relaxed);
+            if (waited > max_wait_ns_.load(std::memory_order_relaxed)) {
+                max_wait_ns_.store(waited, std::memory_order_relaxed);
+            }
+            // this handoff stays counted while granting, so a release() nested in the grant, e.g. by a
+            // call completing inline, only adds to the backlog served by this loop
+            waiter->grant(waiter);
+            if (handoffs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                return;
+            }
+        }
+    }
+
+    std::int64_t permits() const noexcept {
+        return permits_;
+    }
+
+    // in flight and queued calls and the wait times so far, a snapshot
+    stats_t stats() const noexcept {
+        const auto count = count_.load(std::memory_order_acquire);
+        return stats_t{permits_ - std::max<std::int64_t>(count, 0), std::max<std::int64_t>(-count, 0),
+                       waits_.load(std::memory_order_relaxed), total_wait_ns_.load(std::memory_order_relaxed),
+                       max_wait_ns_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    // Vyukov's intrusive MPSC queue, pushed by any waiter, popped only by the thread serving handoffs
+    void push(detail::semaphore_waiter* node) noexcept {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // the waiter was counted before it linked itself, so spins over that short window
+    detail::semaphore_waiter* pop() noexcept {
+        for (;;) {
+            if (auto node = try_pop()) {
+                return node;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    detail::semaphore_waiter* try_pop() noexcept {
+        auto tail = tail_;
+        auto next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        push(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    const std::int64_t permits_;
+    std::atomic<std::int64_t> count_;
+    std::atomic<std::int64_t> handoffs_{0};
+    detail::semaphore_waiter stub_{nullptr};
+    std::atomic<detail::semaphore_waiter*> head_{&stub_};
+    detail::semaphore_waiter* tail_{&stub_};
+    std::atomic<std::uint64_t> waits_{0};
+    std::atomic<std::uint64_t> total_wait_ns_{0};
+    std::atomic<std::uint64_t> max_wait_ns_{0};
+};
+
+namespace detail {
+
+// a placeholder completed early with a std::system_error on the deadline or a stop request
+template <typename _Placeholder>
+struct placeholder_cancellable_t final {
+    _Placeholder placeholder;
+    std::chrono::steady_clock::time_point deadline;
+    stop_token token;
+};
+
+template <typename _Placeholder>
+struct is_placeholder<placeholder_cancellable_t<_Placeholder>> : std::true_type {};
+
+template <typename _Placeholder>
+placeholder_cancellable_t<_Placeholder> make_cancellable(const _Placeholder& placeholder) {
+    return {placeholder, std::chrono::steady_clock::time_point::max(), stop_token{}};
+}
+
+template <typename _Placeholder>
+placeholder_cancellable_t<_Placeholder> make_cancellable(const placeholder_cancellable_t<_Placeholder>& placeholder) {
+    return placeholder;
+}
+
+// a placeholder whose callback takes an error first, completed with an expected of the rest
+template <typename _Placeholder>
+struct placeholder_expected_t final {
+    _Placeholder placeholder;
+};
+
+template <typename _Placeholder>
+struct is_placeholder<placeholder_expected_t<_Placeholder>> : std::true_type {};
+
+// a placeholder whose call holds a permit of semaphore from before the call until the callback
+template <typename _Placeholder>
+struct placeholder_limited_t final {
+    async_semaphore* semaphore;
+    _Placeholder placeholder;
+};
+
+template <typename _Placeholder>
+struct is_placeholder<placeholder_limited_t<_Placeholder>> : std::true_type {};
+
+template <typename _Clock, typename _Duration>
+std::chrono::steady_clock::time_point to_steady(const std::chrono::time_point<_Clock, _Duration>& time_point) {
+    return std::chrono::steady_clock::now() +
+           std::chrono::duration_cast<std::chrono::steady_clock::duration>(time_point - _Clock::now());
+}
+
+template <typename _Duration>
+std::chrono::steady_clock::time_point to_steady(
+    const std::chrono::time_point<std::chrono::steady_clock, _Duration>& time_point) {
+    return std::chrono::time_point_cast<std::chrono::steady_clock::duration>(time_point);
+}
+
+} // namespace detail
+
+struct in_place_t final {
+    explicit in_place_t() = default;
+};
+
+struct unexpect_t final {
+    explicit unexpect_t() = default;
+};
+
+constexpr in_place_t in_place{};
+constexpr unexpect_t unexpect{};
+
+// either a value or an error, what an as_expected call completes with. nothing on the way from the
+// callback to the caller throws, value() does when there is none.
+template <typename _Ty, typename _Error>
+class expected {
+public:
+    using value_type = _Ty;
+    using error_type = _Error;
+
+    expected() : has_value_{true} {
+        ::new (static_cast<void*>(std::addressof(value_))) _Ty();
+    }
+
+    expected(const _Ty& value) : expected{in_place, value} {
+    }
+
+    expected(_Ty&& value) : expected{in_place, std::move(value)} {
+    }
+
+    template <typename... _Args>
+    explicit expected(in_place_t, _Args&&... args) : has_value_{true} {
+        ::new (static_cast<void*>(std::addressof(value_))) _Ty(std::forward<_Args>(args)...);
+    }
+
+    template <typename... _Args>
+    explicit expected(unexpect_t, _Args&&... args) : has_value_{false} {
+        ::new (static_cast<void*>(std::addressof(error_))) _Error(std::forward<_Args>(args)...);
+    }
+
+    expected(const expected& rhs) : has_value_{rhs.has_value_} {
+        if (has_value_) {
+            ::new (static_cast<void*>(std::addressof(value_))) _Ty(rhs.value_);
+        } else {
+            ::new (static_cast<void*>(std::addressof(error_))) _Error(rhs.error_);
+        }
+    }
+
+    expected(expected&& rhs) noexcept(
+        std::is_nothrow_move_constructible<_Ty>{} && std::is_nothrow_move_constructible<_Error>{})
+        : has_value_{rhs.has_value_} {
+        if (has_value_) {
+            ::new (static_cast<void*>(std::addressof(value_))) _Ty(std::move(rhs.value_));
+        } else {
+            ::new (static_cast<void*>(std::addressof(error_))) _Error(std::move(rhs.error_));
+        }
+    }
+
+    expected& operator=(const expected& rhs) {
+        if (std::addressof(rhs) != this) {
+            destroy();
+            ::new (static_cast<void*>(this)) expected(rhs);
+        }
+        return *this;
+    }
+
+    expected& operator=(expected&& rhs) noexcept(
+        std::is_nothrow_move_constructible<_Ty>{} && std::is_nothrow_move_constructible<_Error>{}) {
+        if (std::addressof(rhs) != this) {
+            destroy();
+            ::new (static_cast<void*>(this)) expected(std::move(rhs));
+        }
+        return *this;
+    }
+
+    ~expected() {
+        destroy();
+    }
+
+    bool has_value() const noexcept {
+        return has_value_;
+    }
+
+    explicit operator bool() const noexcept {
+        return has_value_;
+    }
+
+    _Ty& value() & {
+        check();
+        return value_;
+    }
+
+    const _Ty& value() const& {
+        check();
+        return value_;
+    }
+
+    _Ty&& value() && {
+        check();
+        return std::move(value_);
+    }
+
+    template <typename _Other>
+    _Ty value_or(_Other&& other) const& {
+        return has_value_ ? value_ : static_cast<_Ty>(std::forward<_Other>(other));
+    }
+
+    template <typename _Other>
+    _Ty value_or(_Other&& other) && {
+        return has_value_ ? std::move(value_) : static_cast<_Ty>(std::forward<_Other>(other));
+    }
+
+    // unchecked
+    _Ty& operator*() & noexcept {
+        return value_;
+    }
+
+    const _Ty& operator*() const& noexcept {
+        return value_;
+    }
+
+    _Ty&& operator*() && noexcept {
+        return std::move(value_);
+    }
+
+    _Ty* operator->() noexcept {
+        return std::addressof(value_);
+    }
+
+    const _Ty* operator->() const noexcept {
+        return std::addressof(value_);
+    }
+
+    // only without a value
+    _Error& error() & noexcept {
+        return error_;
+    }
+
+    const _Error& error() const& noexcept {
+        return error_;
+    }
+
+    _Error&& error() && noexcept {
+        return std::move(error_);
+    }
+
+private:
+    void check() const {
+        if (!has_value_) {
+            throw std::runtime_error{"no value"};
+        }
+    }
+
+    void destroy() noexcept {
+        if (has_value_) {
+            value_.~_Ty();
+        } else {
+            error_.~_Error();
+        }
+    }
+
+    union {
+        _Ty value_;
+        _Error error_;
+    };
+    bool has_value_;
+};
+
+template <typename _Error>
+class expected<void, _Error> {
+public:
+    using value_type = void;
+    using error_type = _Error;
+
+    expected() noexcept : has_value_{true} {
+    }
+
+    explicit expected(in_place_t) noexcept : has_value_{true} {
+    }
+
+    template <typename... _Args>
+    explicit expected(unexpect_t, _Args&&... args) : has_value_{false} {
+        ::new (static_cast<void*>(std::addressof(error_))) _Error(std::forward<_Args>(args)...);
+    }
+
+    expected(const expected& rhs) : has_value_{rhs.has_value_} {
+        if (!has_value_) {
+            ::new (static_cast<void*>(std::addressof(error_))) _Error(rhs.error_);
+        }
+    }
+
+    expected(expected&& rhs) noexcept(std::is_nothrow_move_constructible<_Error>{}) : has_value_{rhs.has_value_} {
+        if (!has_value_) {
+            ::new (static_cast<void*>(std::addressof(error_))) _Error(std::move(rhs.error_));
+        }
+    }
+
+    expected& operator=(const expected& rhs) {
+        if (std::addressof(rhs) != this) {
+            destroy();
+            ::new (static_cast<void*>(this)) expected(rhs);
+        }
+        return *this;
+    }
+
+    expected& operator=(expected&& rhs) noexcept(std::is_nothrow_move_constructible<_Error>{}) {
+        if (std::addressof(rhs) != this) {
+            destroy();
+            ::new (static_cast<void*>(this)) expected(std::move(rhs));
+        }
+        return *this;
+    }
+
+    ~expected() {
+        destroy();
+    }
+
+    bool has_value() const noexcept {
+        return has_value_;
+    }
+
+    explicit operator bool() const noexcept {
+        return has_value_;
+    }
+
+    void value() const {
+        if (!has_value_) {
+            throw std::runtime_error{"no value"};
+        }
+    }
+
+    // only without a value
+    _Error& error() & noexcept {
+        return error_;
+    }
+
+    const _Error& error() const& noexcept {
+        return error_;
+    }
+
+    _Error&& error() && noexcept {
+        return std::move(error_);
+    }
+
+private:
+    void destroy() noexcept {
+        if (!has_value_) {
+            error_.~_Error();
+        }
+    }
+
+    union {
+        _Error error_;
+    };
+    bool has_value_;
+};
+
+template <typename _Ty>
+class continuable_future;
+
+namespace detail {
+
+template <typename _Ty>
+class blocking_promise;
+
+} // namespace detail
+
+// the result of a placeholder::blocking call. a waiting thread spins for a while, as long as spinning
+// paid off lately, then sleeps on the state word, so a callback arriving within microseconds is
+// picked up without a futex round trip and a completion without sleeper costs one exchange.
+template <typename _Ty>
+class blocking_future {
+public:
+    blocking_future() noexcept = default;
+    blocking_future(const blocking_future&) = delete;
+    blocking_future& operator=(const blocking_future&) = delete;
+
+    blocking_future(blocking_future&& rhs) noexcept : promise_{rhs.promise_}, owner_{rhs.owner_} {
+        rhs.promise_ = nullptr;
+        rhs.owner_ = nullptr;
+    }
+
+    blocking_future& operator=(blocking_future&& rhs) noexcept {
+        if (std::addressof(rhs) != this) {
+            reset();
+            promise_ = rhs.promise_;
+            owner_ = rhs.owner_;
+            rhs.promise_ = nullptr;
+            rhs.owner_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~blocking_future() {
+        reset();
+    }
+
+    bool valid() const noexcept {
+        return promise_ != nullptr;
+    }
+
+    bool ready() const noexcept {
+        return promise_->ready();
+    }
+
+    void wait() const {
+        promise_->wait();
+    }
+
+    template <typename _Rep, typename _Period>
+    std::future_status wait_for(const std::chrono::duration<_Rep, _Period>& timeout) const {
+        return wait_until(std::chrono::steady_clock::now() + timeout);
+    }
+
+    template <typename _Clock, typename _Duration>
+    std::future_status wait_until(const std::chrono::time_point<_Clock, _Duration>& deadline) const {
+        return promise_->wait_until(deadline) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    // waits, then moves the result out or rethrows, once
+    _Ty get() {
+        wait();
+        blocking_future self{std::move(*this)};
+        return self.promise_->get();
+    }
+
+private:
+    friend class detail::blocking_promise<_Ty>;
+
+    blocking_future(detail::blocking_promise<_Ty>* promise, detail::shared_state_base* owner) noexcept
+        : promise_{promise}, owner_{owner} {
+    }
+
+    void reset() noexcept {
+        if (owner_) {
+            owner_->release();
+        }
+        promise_ = nullptr;
+        owner_ = nullptr;
+    }
+
+    detail::blocking_promise<_Ty>* promise_{nullptr};
+    detail::shared_state_base* owner_{nullptr};
+};
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+class awaitable_future;
+
+namespace detail {
+
+template <typename _Ty>
+void wait_future(awaitable_future<_Ty>& future);
+
+} // namespace detail
+
+// the result of a wrapped call or of a coroutine returning it. dropping the future of a coroutine
+// that is still running detaches it, its frame is freed when it finishes.
+template <typename _Ty>
+class awaitable_future {
+public:
+    using promise_type = detail::coroutine_promise<_Ty>;
+
+    awaitable_future() noexcept = default;
+    awaitable_future(const awaitable_future&) = delete;
+    awaitable_future& operator=(const awaitable_future&) = delete;
+
+    awaitable_future(awaitable_future&& rhs) noexcept(std::is_nothrow_move_constructible<detail::inline_result<_Ty>>{})
+        : promise_{rhs.promise_}, owner_{rhs.owner_}, inline_{std::move(rhs.inline_)} {
+        rhs.promise_ = nullptr;
+        rhs.owner_ = nullptr;
+    }
+
+    awaitable_future& operator=(awaitable_future&& rhs) noexcept(
+        std::is_nothrow_move_assignable<detail::inline_result<_Ty>>{}) {
+        if (std::addressof(rhs) != this) {
+            reset();
+            promise_ = rhs.promise_;
+            owner_ = rhs.owner_;
+            inline_ = std::move(rhs.inline_);
+            rhs.promise_ = nullptr;
+            rhs.owner_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~awaitable_future() {
+        reset();
+    }
+
+    // for coroutine
+    bool await_ready() const noexcept {
+        return inline_.has_value() || promise_->ready();
+    }
+
+    // for coroutine
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        return promise_->suspend(std::move(handle));
+    }
+
+    // for coroutine, rethrows the exception the call completed with
+    _Ty await_resume() {
+        if (inline_.has_value()) {
+            return inline_.take();
+        }
+        return promise_->get();
+    }
+
+    bool ready() const noexcept {
+        return await_ready();
+    }
+
+    // blocks the calling thread until the result is there, outside of a coroutine
+    void wait() {
+        if (!await_ready()) {
+            detail::wait_future(*this);
+        }
+    }
+
+    // joins, then returns the result or rethrows
+    _Ty get() {
+        wait();
+        return await_resume();
+    }
+
+    // lets a coroutine run on without anyone waiting for it, same as dropping the future
+    void detach() noexcept {
+        reset();
+    }
+
+private:
+    template <typename>
+    friend class detail::awaitable_promise;
+
+    friend struct detail::awaitable_access;
+
+    template <typename>
+    friend class detail::inline_call_scope;
+
+    explicit awaitable_future(detail::awaitable_promise<_Ty>* promise,
+                              detail::shared_state_base* owner = nullptr) noexcept
+        : promise_{promise}, owner_{owner} {
+    }
+
+    void reset() noexcept {
+        if (owner_) {
+            owner_->release();
+        }
+        promise_ = nullptr;
+        owner_ = nullptr;
+    }
+
+    detail::awaitable_promise<_Ty>* promise_{nullptr};
+    // the completion state promise_ lives in, null when promise_ belongs to a coroutine frame
+    detail::shared_state_base* owner_{nullptr};
+    // the value of a call whose callback fired before async_wrapper returned, see inline_call_scope
+    detail::inline_result<_Ty> inline_;
+};
+
+namespace detail {
+
+template <typename _Ty>
+class local_awaitable_promise;
+
+} // namespace detail
+
+// the result of a placeholder::awaitable_st call, the call, its callback and the awaiting coroutine
+// stay on one thread. awaited only, blocking would wait for the thread itself.
+template <typename _Ty>
+class awaitable_st_future {
+public:
+    awaitable_st_future() noexcept = default;
+    awaitable_st_future(const awaitable_st_future&) = delete;
+    awaitable_st_future& operator=(const awaitable_st_future&) = delete;
+
+    awaitable_st_future(awaitable_st_future&& rhs) noexcept : promise_{rhs.promise_}, owner_{rhs.owner_} {
+        rhs.promise_ = nullptr;
+        rhs.owner_ = nullptr;
+    }
+
+    awaitable_st_future& operator=(awaitable_st_future&& rhs) noexcept {
+        if (std::addressof(rhs) != this) {
+            reset();
+            promise_ = rhs.promise_;
+            owner_ = rhs.owner_;
+            rhs.promise_ = nullptr;
+            rhs.owner_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~awaitable_st_future() {
+        reset();
+    }
+
+    bool await_ready() const noexcept {
+        return promise_->ready();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        return promise_->suspend(handle);
+    }
+
+    // rethrows the exception the call completed with
+    _Ty await_resume() {
+        return promise_->get();
+    }
+
+    bool ready() const noexcept {
+        return await_ready();
+    }
+
+private:
+    friend class detail::local_awaitable_promise<_Ty>;
+
+    awaitable_st_future(detail::local_awaitable_promise<_Ty>* promise, detail::local_state_base* owner) noexcept
+        : promise_{promise}, owner_{owner} {
+    }
+
+    void reset() noexcept {
+        if (owner_) {
+            owner_->release();
+        }
+        promise_ = nullptr;
+        owner_ = nullptr;
+    }
+
+    detail::local_awaitable_promise<_Ty>* promise_{nullptr};
+    detail::local_state_base* owner_{nullptr};
+};
+
+template <typename _Ty>
+using awaitable_st_t = awaitable_st_future<_Ty>;
+
+namespace detail {
+
+// the promise of the call async_wrapper is running on this thread and where its result goes
+// if the callback fires before func returns
+struct inline_completion final {
+    const void* promise;
+    void* target;
+};
+
+inline inline_completion& current_inline_completion() noexcept {
+    static thread_local inline_completion current{nullptr, nullptr};
+    return current;
+}
+
+// while alive, a synchronous completion of future's promise constructs the result in the future
+// itself. the completion state is dropped afterwards, so the future is ready without it.
+template <typename _Ty>
+class inline_call_scope final {
+public:
+    explicit inline_call_scope(awaitable_future<_Ty>& future) noexcept
+        : future_{future}, outer_{current_inline_completion()} {
+        current_inline_completion() = inline_completion{future.promise_, &future.inline_};
+    }
+
+    inline_call_scope(const inline_call_scope&) = delete;
+    inline_call_scope& operator=(const inline_call_scope&) = delete;
+
+    ~inline_call_scope() {
+        current_inline_completion() = outer_;
+        if (future_.inline_.has_value()) {
+            future_.reset();
+        }
+    }
+
+private:
+    awaitable_future<_Ty>& future_;
+    inline_completion outer_;
+};
+
+} // namespace detail
+
+template <typename _Ty>
+using awaitable_t = awaitable_future<_Ty>;
+
+using awaitable = awaitable_t<void>;
+#endif // defined(ENABLE_CO_AWAIT)
+
+namespace placeholder {
+
+constexpr detail::placeholder_std_future_t std_future{};
+constexpr detail::placeholder_awaitable_t awaitable{};
+// like awaitable, for a call whose callback fires on the thread of the awaiting coroutine, e.g. one
+// event loop thread. the completion state takes no atomic operation, debug builds assert the thread.
+constexpr detail::placeholder_awaitable_st_t awaitable_st{};
+// returns a continuable_future, consumed with then() instead of blocking or a coroutine
+constexpr detail::placeholder_continuable_t continuable{};
+// returns a blocking_future, for threads that wait like with std_future but see quick completions
+constexpr detail::placeholder_blocking_t blocking{4096};
+
+// blocking with another bound of the spin before sleeping
+constexpr detail::placeholder_blocking_t blocking_spin(std::uint32_t max_spins) {
+    return detail::placeholder_blocking_t{max_spins};
+}
+
+// the call starts only when awaited or, sender style, connected to a receiver and started.
+// the state lives in the awaiting coroutine frame or the operation state, nothing is allocated.
+constexpr detail::placeholder_deferred_t deferred{};
+
+// for C APIs taking a function pointer and a void* passed back to it, e.g.
+//   void read(int fd, void (*cb)(void* user, int status), void* user);
+//   async_wrapper(read, fd, placeholder::awaitable, placeholder::user_data);
+// any placeholder goes where the function pointer does, the call completes with the other arguments
+constexpr detail::placeholder_user_data_t user_data{};
+
+#if defined(ENABLE_CO_AWAIT)
+// resumes the awaiting coroutine on executor instead of the thread running the callback.
+// executor is referenced when passed as lvalue and must outlive the call, otherwise it is moved in.
+// the executor has to provide
+//   void post(F f);                      // runs the nullary callable f later, must not throw
+// and, with inline_if_running only,
+//   bool running_in_this_thread() const; // true if a posted f would run on the calling thread
+template <typename _Executor>
+constexpr auto awaitable_on(_Executor&& executor) {
+    return detail::placeholder_awaitable_on_t<_Executor, false>{std::forward<_Executor>(executor)};
+}
+
+// as above, but resumes inline when the callback already fires on the executor
+template <typename _Executor>
+constexpr auto awaitable_on(_Executor&& executor, detail::inline_if_running_t) {
+    return detail::placeholder_awaitable_on_t<_Executor, true>{std::forward<_Executor>(executor)};
+}
+
+constexpr detail::inline_if_running_t inline_if_running{};
+#endif // defined(ENABLE_CO_AWAIT)
+
+// completes with std::errc::timed_out once deadline passed, a callback arriving later is dropped.
+// deadlines are served by one shared timer thread with millisecond resolution, an awaiting coroutine
+// is resumed there unless the placeholder is awaitable_on.
+template <typename _Placeholder, typename _Clock, typename _Duration>
+auto with_deadline(const _Placeholder& placeholder, const std::chrono::time_point<_Clock, _Duration>& deadline) {
+    auto result = detail::make_cancellable(placeholder);
+    result.deadline = std::min(result.deadline, detail::to_steady(deadline));
+    return result;
+}
+
+template <typename _Placeholder, typename _Rep, typename _Period>
+auto with_timeout(const _Placeholder& placeholder, const std::chrono::duration<_Rep, _Period>& timeout) {
+    return with_deadline(placeholder, std::chrono::steady_clock::now() + timeout);
+}
+
+// completes with std::errc::operation_canceled when stop is requested on token's source
+template <typename _Placeholder>
+auto with_stop_token(const _Placeholder& placeholder, stop_token token) {
+    auto result = detail::make_cancellable(placeholder);
+    result.token = std::move(token);
+    return result;
+}
+
+// for callbacks like void(std::error_code, T...), completes with expected<T, std::error_code> instead
+// of a tuple: the error when it converts to true, otherwise the rest of the arguments. a deadline or
+// stop request yields std::errc::timed_out/operation_canceled as error if error_type takes an error_code.
+// placeholder::as_expected(placeholder::awaitable) or any other placeholder, also under with_timeout.
+template <typename _Placeholder>
+auto as_expected(const _Placeholder& placeholder) {
+    return detail::placeholder_expected_t<_Placeholder>{placeholder};
+}
+
+template <typename _Placeholder>
+auto as_expected(const detail::placeholder_cancellable_t<_Placeholder>& placeholder) {
+    return detail::placeholder_cancellable_t<detail::placeholder_expected_t<_Placeholder>>{
+        {placeholder.placeholder}, placeholder.deadline, placeholder.token};
+}
+
+// at most semaphore.permits() calls in flight, a permit is returned as the callback fires.
+// without a free permit, a std::future call blocks the calling thread. any other call returns its
+// future right away and starts on the thread handing over the permit, a deferred one once awaited
+// or started. outermost, not under with_timeout.
+template <typename _Placeholder>
+auto limited(async_semaphore& semaphore, const _Placeholder& placeholder) {
+    return detail::placeholder_limited_t<_Placeholder>{&semaphore, placeholder};
+}
+
+} // namespace placeholder
+
+namespace detail {
+
+// index of the first placeholder, the tuple size if there is none
+template <typename _Tuple>
+struct placeholder_index;
+
+template <>
+struct placeholder_index<std::tuple<>> : std::integral_constant<std::size_t, 0> {};
+
+template <typename _Head, typename... _Args>
+struct placeholder_index<std::tuple<_Head, _Args...>>
+    : std::integral_constant<std::size_t,
+                             is_placeholder<_Head>{} ? 0 : 1 + placeholder_index<std::tuple<_Args...>>{}> {};
+
+template <typename _Ty, typename... _Rest>
+struct all_same : std::true_type {};
+
+template <typename _Ty, typename _Next, typename... _Rest>
+struct all_same<_Ty, _Next, _Rest...>
+    : std::integral_constant<bool, std::is_same<_Ty, _Next>{} && all_same<_Ty, _Rest...>{}> {};
+
+template <typename _Ty>
+struct function_args;
+
+template <typename _Ret, typename... _Args>
+struct function_args<_Ret(_Args...)> {
+    using type = _Ret(_Args...);
+    using function_type = std::function<type>;
+    using return_type = _Ret;
+    static constexpr std::size_t arity{sizeof...(_Args)};
+
+    using args_tuple = std::tuple<std::decay_t<_Args>...>;
+
+    template <std::size_t _Index>
+    struct arg {
+        using type = std::decay_t<typename std::tuple_element<_Index, std::tuple<_Args...>>::type>;
+    };
+
+    template <std::size_t _Index>
+    using arg_t = typename arg<_Index>::type;
+};
+
+template <typename _Ret, typename _Arg>
+struct function_args<_Ret(_Arg)> {
+    using type = _Ret(_Arg);
+    using function_type = std::function<type>;
+    using return_type = _Ret;
+    static constexpr std::size_t arity{1};
+
+    using args_tuple = std::decay_t<_Arg>;
+
+    template <std::size_t _Index>
+    struct arg {
+        using type = std::decay_t<_Arg>;
+    };
+
+    template <std::size_t _Index>
+    using arg_t = typename arg<_Index>::type;
+};
+
+template <typename _Ret>
+struct function_args<_Ret()> {
+    using type = _Ret();
+    using function_type = std::function<type>;
+    using return_type = _Ret;
+    static constexpr std::size_t arity{0};
+
+    using args_tuple = void;
+
+    template <std::size_t _Index>
+    struct arg {
+        using type = void;
+    };
+
+    template <std::size_t _Index>
+    using arg_t = typename arg<_Index>::type;
+};
+
+template <typename _Ret, typename... _Args>
+struct function_args<_Ret (*)(_Args...)> : function_args<_Ret(_Args...)> {};
+
+template <typename _Ret, typename... _Args>
+struct function_args<std::function<_Ret(_Args...)>> : function_args<_Ret(_Args...)> {};
+
+template <typename _Ret, typename _Ty, typename... _Args>
+struct function_args<_Ret (_Ty::*)(_Args...)> : function_args<_Ret(_Args...)> {};
+
+template <typename _Ret, typename _Ty, typename... _Args>
+struct function_args<_Ret (_Ty::*)(_Args...) const> : function_args<_Ret(_Args...)> {};
+
+template <typename _Ty>
+struct function_args : function_args<decltype(&_Ty::operator())> {};
+
+#if defined(ENABLE_CO_AWAIT)
+class awaitable_promise_base {
+public:
+    awaitable_promise_base() noexcept = default;
+    awaitable_promise_base(const awaitable_promise_base&) = delete;
+    awaitable_promise_base& operator=(const awaitable_promise_base&) = delete;
+
+    void set_exception(std::exception_ptr exception) noexcept {
+        exception_ = std::move(exception);
+        complete();
+    }
+
+    bool ready() const noexcept {
+        return state_.load(std::memory_order_acquire) == ready_state;
+    }
+
+    // completion hook for waiters that are not a coroutine, see when_all/when_any
+    struct continuation {
+        void (*resume)(continuation*);
+    };
+
+    // false if the result is already there, the awaiting coroutine then continues inline
+    bool suspend(std::coroutine_handle<> handle) noexcept {
+        auto expected = empty_state;
+        return state_.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(handle.address()),
+                                              std::memory_order_release, std::memory_order_acquire);
+    }
+
+    // false if the result is already there, node->resume is not called then
+    bool suspend(continuation* node) noexcept {
+        auto expected = empty_state;
+        return state_.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(node) | continuation_tag,
+                                              std::memory_order_release, std::memory_order_acquire);
+    }
+
+    // takes back a registered node, false if the result arrived and node->resume runs or ran
+    bool unsuspend(continuation* node) noexcept {
+        auto expected = reinterpret_cast<std::uintptr_t>(node) | continuation_tag;
+        return state_.compare_exchange_strong(expected, empty_state, std::memory_order_acq_rel,
+                                              std::memory_order_acquire);
+    }
+
+    void rethrow_exception() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+    }
+
+protected:
+    // publishes the result written before, completes at most once
+    void complete() noexcept {
+        if (auto handle = finish()) {
+            handle.resume();
+        }
+    }
+
+    // as complete(), but returns the awaiting coroutine instead of resuming it, for a caller that
+    // continues with it through symmetric transfer. null if nothing is left to resume inline.
+    std::coroutine_handle<> finish() noexcept {
+        const auto state = state_.exchange(ready_state, std::memory_order_acq_rel);
+        if (state == empty_state || state == ready_state) {
+            return nullptr;
+        }
+        if (state & continuation_tag) {
+            auto node = reinterpret_cast<continuation*>(state & ~continuation_tag);
+            node->resume(node);
+            return nullptr;
+        }
+        auto handle = std::coroutine_handle<>::from_address(reinterpret_cast<void*>(state));
+        if (scheduler_) {
+            return scheduler_->schedule(handle);
+        }
+        return handle;
+    }
+
+    // resumes the awaiting coroutine somewhere else than inline, or returns it to be resumed inline
+    class scheduler {
+    public:
+        virtual std::coroutine_handle<> schedule(std::coroutine_handle<> handle) noexcept = 0;
+
+    protected:
+        ~scheduler() = default;
+    };
+
+    std::exception_ptr exception_{nullptr};
+    scheduler* scheduler_{nullptr};
+
+private:
+    // empty, ready, the address of the waiting coroutine, or a continuation tagged with continuation_tag
+    static constexpr std::uintptr_t empty_state{0};
+    static constexpr std::uintptr_t ready_state{1};
+    static constexpr std::uintptr_t continuation_tag{1};
+
+    std::atomic<std::uintptr_t> state_{empty_state};
+};
+
+template <typename _Ty>
+class awaitable_promise : public awaitable_promise_base {
+public:
+    using promise_type = awaitable_promise<_Ty>;
+    using future_type = awaitable_future<_Ty>;
+
+    awaitable_promise() noexcept = default;
+    awaitable_promise(const awaitable_promise&) = delete;
+    awaitable_promise& operator=(const awaitable_promise&) = delete;
+
+    ~awaitable_promise() {
+        if (has_value_) {
+            value().~_Ty();
+        }
+    }
+
+    future_type get_future(shared_state_base* owner) {
+        return future_type{this, owner};
+    }
+
+    // for coroutine, the result is published at final suspend
+    template <typename _Value>
+    void return_value(_Value&& value) {
+        ::new (static_cast<void*>(&storage_)) _Ty(std::forward<_Value>(value));
+        has_value_ = true;
+    }
+
+    template <typename _Value>
+    void set_value(_Value&& value) {
+        emplace_value(std::forward<_Value>(value));
+    }
+
+    // constructs the result in place from the callback arguments, in the future itself when
+    // async_wrapper is still running on this thread. a throwing constructor completes with its exception.
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        try {
+            auto& current = current_inline_completion();
+            if (current.promise == this) {
+                current.promise = nullptr;
+                static_cast<inline_result<_Ty>*>(current.target)->emplace(std::forward<_Args>(args)...);
+                return;
+            }
+            ::new (static_cast<void*>(&storage_)) _Ty(std::forward<_Args>(args)...);
+            has_value_ = true;
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+        complete();
+    }
+
+    // moves the result out, it stays owned by the promise until destruction
+    _Ty get() {
+        if (!ready()) {
+            exception_ = std::make_exception_ptr(std::runtime_error{"no value"});
+        }
+        rethrow_exception();
+        return std::move(value());
+    }
+
+private:
+    _Ty& value() noexcept {
+        return *reinterpret_cast<_Ty*>(&storage_);
+    }
+
+    typename std::aligned_storage<sizeof(_Ty), alignof(_Ty)>::type storage_;
+    bool has_value_{false};
+};
+
+template <>
+class awaitable_promise<void> : public awaitable_promise_base {
+public:
+    using promise_type = awaitable_promise<void>;
+    using future_type = awaitable_future<void>;
+
+    awaitable_promise() noexcept = default;
+    awaitable_promise(const awaitable_promise&) = delete;
+    awaitable_promise& operator=(const awaitable_promise&) = delete;
+
+    future_type get_future(shared_state_base* owner) {
+        return future_type{this, owner};
+    }
+
+    // for coroutine, completion is published at final suspend
+    void return_void() noexcept {
+    }
+
+    void set_value() {
+        auto& current = current_inline_completion();
+        if (current.promise == this) {
+            current.promise = nullptr;
+            static_cast<inline_result<void>*>(current.target)->emplace();
+            return;
+        }
+        complete();
+    }
+
+    void get() {
+        if (!ready()) {
+            exception_ = std::make_exception_ptr(std::runtime_error{"no value"});
+        }
+        rethrow_exception();
+    }
+};
+
+// the promise of placeholder::awaitable_st, plain loads and stores only
+template <typename _Ty>
+class local_awaitable_promise final : thread_affinity {
+public:
+    using future_type = awaitable_st_future<_Ty>;
+
+    local_awaitable_promise() noexcept = default;
+    local_awaitable_promise(const local_awaitable_promise&) = delete;
+    local_awaitable_promise& operator=(const local_awaitable_promise&) = delete;
+
+    future_type get_future(local_state_base* owner) noexcept {
+        return future_type{this, owner};
+    }
+
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        check_thread();
+        try {
+            result_.emplace(std::forward<_Args>(args)...);
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+        complete();
+    }
+
+    void set_exception(std::exception_ptr exception) noexcept {
+        check_thread();
+        exception_ = std::move(exception);
+        complete();
+    }
+
+    bool ready() const noexcept {
+        return ready_;
+    }
+
+    // false if the result is already there
+    bool suspend(std::coroutine_handle<> handle) noexcept {
+        check_thread();
+        if (ready_) {
+            return false;
+        }
+        waiter_ = handle;
+        return true;
+    }
+
+    _Ty get() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        return result_.take();
+    }
+
+private:
+    void complete() noexcept {
+        ready_ = true;
+        if (waiter_) {
+            waiter_.resume();
+        }
+    }
+
+    inline_result<_Ty> result_;
+    std::exception_ptr exception_{nullptr};
+    std::coroutine_handle<> waiter_;
+    bool ready_{false};
+};
+
+template <typename _Ty, typename _Executor, bool _Inline>
+class awaitable_promise_on final : public awaitable_promise<_Ty>, private awaitable_promise_base::scheduler {
+public:
+    explicit awaitable_promise_on(_Executor executor) : executor_{std::forward<_Executor>(executor)} {
+        this->scheduler_ = this;
+    }
+
+private:
+    std::coroutine_handle<> schedule(std::coroutine_handle<> handle) noexcept override {
+        return schedule(handle, std::integral_constant<bool, _Inline>{});
+    }
+
+    // on the executor's thread already, the caller resumes it, by symmetric transfer from a coroutine
+    std::coroutine_handle<> schedule(std::coroutine_handle<> handle, std::true_type) noexcept {
+        if (executor_.running_in_this_thread()) {
+            return handle;
+        }
+        return schedule(handle, std::false_type{});
+    }
+
+    std::coroutine_handle<> schedule(std::coroutine_handle<> handle, std::false_type) noexcept {
+        // a coroutine handle is a nullary callable itself, executors may take it without allocating
+        executor_.post(handle);
+        return nullptr;
+    }
+
+    _Executor executor_;
+};
+#endif // defined(ENABLE_CO_AWAIT)
+
+// the promise of placeholder::blocking. the state word is empty, ready, or sleeping once a waiter
+// is about to sleep, so only a completion finding a sleeper makes the wake up system call.
+template <typename _Ty>
+class blocking_promise final {
+public:
+    using future_type = blocking_future<_Ty>;
+
+    explicit blocking_promise(std::uint32_t max_spins) noexcept : max_spins_{max_spins} {
+    }
+
+    blocking_promise(const blocking_promise&) = delete;
+    blocking_promise& operator=(const blocking_promise&) = delete;
+
+    future_type get_future(shared_state_base* owner) noexcept {
+        return future_type{this, owner};
+    }
+
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        try {
+            result_.emplace(std::forward<_Args>(args)...);
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+        complete();
+    }
+
+    void set_exception(std::exception_ptr exception) noexcept {
+        exception_ = std::move(exception);
+        complete();
+    }
+
+    bool ready() const noexcept {
+        return state_.load(std::memory_order_acquire) == ready_state;
+    }
+
+    void wait() {
+        if (spin()) {
+            return;
+        }
+        while (sleep()) {
+            atomic_wait(state_, sleeping_state);
+        }
+    }
+
+    // false on timeout
+    template <typename _Clock, typename _Duration>
+    bool wait_until(const std::chrono::time_point<_Clock, _Duration>& deadline) {
+        if (spin()) {
+            return true;
+        }
+        while (sleep()) {
+            const auto now = _Clock::now();
+            if (now >= deadline) {
+                return false;
+            }
+            atomic_wait_for(state_, sleeping_state, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now));
+        }
+        return true;
+    }
+
+    _Ty get() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        return result_.take();
+    }
+
+private:
+    static constexpr std::uint32_t empty_state{0};
+    static constexpr std::uint32_t ready_state{1};
+    static constexpr std::uint32_t sleeping_state{2};
+
+    // the current spin bound of this thread, doubled when a spin caught the result, halved when not
+    static std::uint32_t& spin_budget() noexcept {
+        static thread_local std::uint32_t budget{64};
+        return budget;
+    }
+
+    bool spin() noexcept {
+        auto& budget = spin_budget();
+        const auto limit = std::min(budget, max_spins_);
+        for (std::uint32_t i = 0; i < limit; ++i) {
+            if (ready()) {
+                budget = std::min<std::uint32_t>(std::max<std::uint32_t>(budget * 2, 64), 1u << 16);
+                return true;
+            }
+            cpu_relax();
+        }
+        if (ready()) {
+            return true;
+        }
+        budget = std::max<std::uint32_t>(budget / 2, 16);
+        return false;
+    }
+
+    // announces the sleeper, false once ready
+    bool sleep() noexcept {
+        auto state = empty_state;
+        if (state_.compare_exchange_strong(state, sleeping_state, std::memory_order_acq_rel,
+                                           std::memory_order_acquire)) {
+            return true;
+        }
+        return state != ready_state;
+    }
+
+    // publishes the result written before, the completion state outlives the wake up
+    void complete() noexcept {
+        if (state_.exchange(ready_state, std::memory_order_acq_rel) == sleeping_state) {
+            atomic_notify_all(state_);
+        }
+    }
+
+    inline_result<_Ty> result_;
+    std::exception_ptr exception_{nullptr};
+    std::atomic<std::uint32_t> state_{empty_state};
+    const std::uint32_t max_spins_;
+};
+
+template <typename _Ty>
+constexpr std::uint32_t blocking_promise<_Ty>::empty_state;
+
+template <typename _Ty>
+constexpr std::uint32_t blocking_promise<_Ty>::ready_state;
+
+template <typename _Ty>
+constexpr std::uint32_t blocking_promise<_Ty>::sleeping_state;
+
+// completion of a continuable_future. as in awaitable_promise_base the state word is empty, ready, or
+// the continuation attached before the result arrived, so neither side ever takes a lock.
+class continuable_promise_base {
+public:
+    struct continuation {
+        void (*run)(continuation*);
+    };
+
+    continuable_promise_base() noexcept = default;
+    continuable_promise_base(const continuable_promise_base&) = delete;
+    continuable_promise_base& operator=(const continuable_promise_base&) = delete;
+
+    void set_exception(std::exception_ptr exception) noexcept {
+        exception_ = std::move(exception);
+        complete();
+    }
+
+    bool ready() const noexcept {
+        return state_.load(std::memory_order_acquire) == ready_state;
+    }
+
+    // only once ready
+    bool failed() const noexcept {
+        return exception_ != nullptr;
+    }
+
+    std::exception_ptr exception() const noexcept {
+        return exception_;
+    }
+
+    // false if the result is already there, node->run is not called then
+    bool attach(continuation* node) noexcept {
+        auto expected = empty_state;
+        return state_.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(node),
+                                              std::memory_order_release, std::memory_order_acquire);
+    }
+
+protected:
+    // publishes the result written before, completes at most once
+    void complete() noexcept {
+        const auto state = state_.exchange(ready_state, std::memory_order_acq_rel);
+        if (state != empty_state && state != ready_state) {
+            auto node = reinterpret_cast<continuation*>(state);
+            node->run(node);
+        }
+    }
+
+    void rethrow_exception() const {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+    }
+
+    std::exception_ptr exception_{nullptr};
+
+private:
+    static constexpr std::uintptr_t empty_state{0};
+    static constexpr std::uintptr_t ready_state{1};
+
+    std::atomic<std::uintptr_t> state_{empty_state};
+};
+
+template <typename _Ty>
+class continuable_promise : public continuable_promise_base {
+public:
+    continuable_promise() noexcept = default;
+
+    ~continuable_promise() {
+        if (has_value_) {
+            value().~_Ty();
+        }
+    }
+
+    continuable_future<_Ty> get_future(shared_state_base* owner) noexcept {
+        return continuable_future<_Ty>{this, owner};
+    }
+
+    template <typename _Value>
+    void set_value(_Value&& value) {
+        emplace_value(std::forward<_Value>(value));
+    }
+
+    // a throwing constructor completes with its exception
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        try {
+            ::new (static_cast<void*>(&storage_)) _Ty(std::forward<_Args>(args)...);
+            has_value_ = true;
+        } catch (...) {
+            exception_ = std::current_exception();
+        }
+        complete();
+    }
+
+    // only once ready, moves the result out or rethrows
+    _Ty take() {
+        rethrow_exception();
+        return std::move(value());
+    }
+
+private:
+    _Ty& value() noexcept {
+        return *reinterpret_cast<_Ty*>(&storage_);
+    }
+
+    typename std::aligned_storage<sizeof(_Ty), alignof(_Ty)>::type storage_;
+    bool has_value_{false};
+};
+
+template <>
+class continuable_promise<void> : public continuable_promise_base {
+public:
+    continuable_promise() noexcept = default;
+
+    continuable_future<void> get_future(shared_state_base* owner) noexcept;
+
+    void set_value() noexcept {
+        complete();
+    }
+
+    void emplace_value() noexcept {
+        complete();
+    }
+
+    void take() const {
+        rethrow_exception();
+    }
+};
+
+template <typename _Func, std::size_t... _Indexes>
+constexpr auto index_apply_impl(_Func&& func, std::index_sequence<_Indexes...>) {
+    return func(std::integral_constant<std::size_t, _Indexes>{}...);
+}
+
+template <std::size_t _Index, typename _Func>
+constexpr auto index_apply(_Func&& func) {
+    return index_apply_impl(std::forward<_Func>(func), std::make_index_sequence<_Index>{});
+}
+
+template <std::size_t _Index, typename _Tuple>
+constexpr auto take_front(_Tuple&& tp) {
+    return index_apply<_Index>(
+        [&](auto... _Indexes) { return std::make_tuple(std::get<_Indexes>(std::forward<_Tuple>(tp))...); });
+}
+
+template <typename _Tuple, typename _Func>
+constexpr auto apply(_Tuple&& tp, _Func&& func) {
+    return index_apply<std::tuple_size<_Tuple>{}>(
+        [&](auto... _Indexes) { return func(std::get<_Indexes>(std::forward<_Tuple>(tp))...); });
+}
+
+template <typename _Tuple>
+constexpr auto reverse(const _Tuple& tp) {
+    return index_apply<std::tuple_size<_Tuple>{}>(
+        [&](auto... _Indexes) { return std::make_tuple(std::get<std::tuple_size<_Tuple>{} - 1 - _Indexes>(tp)...); });
+}
+
+template <typename _Tuple, std::size_t _Index, typename _Ty,
+          typename _Indexes = std::make_index_sequence<std::tuple_size<_Tuple>{}>>
+struct replace_type_by_index;
+
+template <typename... _Args, std::size_t _Index, typename _Ty, std::size_t... _Indexes>
+struct replace_type_by_index<std::tuple<_Args...>, _Index, _Ty, std::index_sequence<_Indexes...>> {
+    using type = std::tuple<std::conditional_t<_Indexes == _Index, _Ty, _Args>...>;
+};
+
+template <std::size_t _Index, typename _Tuple, typename _Ty>
+constexpr auto replace_tuple_arg_by_index(const _Tuple& tp, _Ty&& t) {
+    return std::tuple_cat(take_front<_Index>(tp), std::make_tuple(std::forward<_Ty>(t)),
+                          reverse(take_front<std::tuple_size<_Tuple>{} - _Index - 1>(reverse(tp))));
+}
+
+template <std::size_t _Index, typename _Ty, typename... _Args>
+constexpr auto replace_arg_by_index(_Ty&& t, _Args&&... args) {
+    auto args_tuple = std::make_tuple(std::forward<_Args>(args)...);
+    return replace_tuple_arg_by_index<_Index>(args_tuple, std::forward<_Ty>(t));
+}
+
+template <typename _Placeholder, typename _Callback>
+_Callback substitute_placeholder(const _Placeholder&, _Callback callback) {
+    return callback;
+}
+
+template <typename _Callback>
+void* substitute_placeholder(placeholder_user_data_t, const _Callback&) {
+    static_assert(!std::is_same<_Callback, _Callback>{}, "placeholder::user_data needs a C function pointer callback");
+    return nullptr;
+}
+
+// what a placeholder argument becomes, the callback unless it is a C callback, see c_callback
+template <typename _Ty, typename _Func>
+constexpr auto replace_arg_impl(_Ty&& t, _Func&& f, std::true_type) {
+    return substitute_placeholder(t, std::forward<_Func>(f));
+}
+
+template <typename _Ty, typename _Func>
+constexpr auto replace_arg_impl(_Ty&& t, _Func&&, std::false_type) {
+    return std::forward<_Ty>(t);
+}
+
+template <bool _True, typename _Ty, typename _Func>
+constexpr auto replace_arg(_Ty&& t, _Func&& f) {
+    return replace_arg_impl(std::forward<_Ty>(t), std::forward<_Func>(f), std::integral_constant<bool, _True>{});
+}
+
+template <typename _Ty, typename _Func>
+constexpr auto replace_placeholder(_Ty&& t, _Func&& f) {
+    return replace_arg<is_placeholder<std::decay_t<_Ty>>{} ||
+                       std::is_same<std::decay_t<_Ty>, placeholder_user_data_t>{}>(std::forward<_Ty>(t),
+                                                                                 std::forward<_Func>(f));
+}
+
+template <typename _Promise, typename... _Args>
+auto apply_callback_impl(_Promise promise, int, _Args&&... args)
+    -> decltype(promise->emplace_value(std::forward<_Args>(args)...)) {
+    return promise->emplace_value(std::forward<_Args>(args)...);
+}
+
+template <typename _Promise>
+void apply_callback_impl(_Promise promise, long) {
+    promise->set_value();
+}
+
+template <typename _Promise, typename _Arg>
+void apply_callback_impl(_Promise promise, long, _Arg&& arg) {
+    promise->set_value(std::forward<_Arg>(arg));
+}
+
+template <typename _Promise, typename _Arg0, typename _Arg1, typename... _Args>
+void apply_callback_impl(_Promise promise, long, _Arg0&& arg0, _Arg1&& arg1, _Args&&... args) {
+    using tuple_t = std::tuple<std::decay_t<_Arg0>, std::decay_t<_Arg1>, std::decay_t<_Args>...>;
+    promise->set_value(tuple_t{std::forward<_Arg0>(arg0), std::forward<_Arg1>(arg1), std::forward<_Args>(args)...});
+}
+
+// promises with emplace_value construct the result in place from the arguments as they are,
+// std::promise gets the value or a tuple of them
+template <typename _Promise, typename... _Args>
+void apply_callback(_Promise promise, _Args&&... args) {
+    apply_callback_impl(promise, 0, std::forward<_Args>(args)...);
+}
+
+// the allocators spare_block keeps a block of: stateless, and not counting or tracing their blocks
+// the way a user allocator may
+template <typename _Allocator>
+struct keeps_spare_block : std::false_type {};
+
+template <typename _Ty>
+struct keeps_spare_block<std::allocator<_Ty>> : std::true_type {};
+
+template <typename _Ty>
+struct keeps_spare_block<recycling_allocator<_Ty>> : std::true_type {};
+
+// keeps the last freed block of a state type per thread, so a call whose callback fires before
+// async_wrapper returns reuses it and allocates nothing. only for the built-in allocators, where
+// any instance may free what another allocated and a block may stay out for the thread's lifetime.
+template <typename _Allocator, bool = keeps_spare_block<_Allocator>{}>
+class spare_block final {
+public:
+    using traits = std::allocator_traits<_Allocator>;
+    using pointer = typename traits::pointer;
+
+    static pointer allocate(_Allocator& allocator) {
+        auto& spare = tls();
+        if (auto block = spare.block) {
+            spare.block = nullptr;
+            return block;
+        }
+        return traits::allocate(allocator, 1);
+    }
+
+    static void deallocate(_Allocator& allocator, pointer block) noexcept {
+        auto& spare = tls();
+        if (!spare.block && !spare.exited) {
+            spare.block = block;
+        } else {
+            traits::deallocate(allocator, block, 1);
+        }
+    }
+
+private:
+    struct thread_state final {
+        ~thread_state() {
+            if (block) {
+                _Allocator allocator;
+                traits::deallocate(allocator, block, 1);
+                block = nullptr;
+            }
+            exited = true;
+        }
+
+        pointer block{nullptr};
+        bool exited{false};
+    };
+
+    static thread_state& tls() noexcept {
+        static thread_local thread_state state;
+        return state;
+    }
+};
+
+template <typename _Allocator>
+class spare_block<_Allocator, false> final {
+public:
+    using traits = std::allocator_traits<_Allocator>;
+    using pointer = typename traits::pointer;
+
+    static pointer allocate(_Allocator& allocator) {
+        return traits::allocate(allocator, 1);
+    }
+
+    static void deallocate(_Allocator& allocator, pointer block) noexcept {
+        traits::deallocate(allocator, block, 1);
+    }
+};
+
+// size class pool with per-thread caches. blocks freed by the owning thread go back to its local
+// free list, blocks freed by any other thread are pushed onto the owner's lock-free remote list
+// and picked up in one exchange when the owner runs dry.
+class recycling_pool final {
+public:
+    static constexpr std::size_t class_count{8};
+    static constexpr std::size_t min_block_size{32};
+    static constexpr std::size_t max_block_size{min_block_size << (class_count - 1)};
+    static constexpr std::size_t max_cached_blocks{256};
+
+    struct stats_type final {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t remote_frees;
+    };
+
+    static void* allocate(std::size_t size) {
+        const auto size_class = class_of(size);
+        thread_cache* cache{size_class < class_count ? local_cache() : nullptr};
+        if (cache) {
+            if (auto block = cache->pop(size_class)) {
+                increase(cache->hits);
+                return block + 1;
+            }
+            increase(cache->misses);
+        }
+        auto block = static_cast<block_header*>(std::malloc(sizeof(block_header) + block_size(size_class, size)));
+        if (!block) {
+            throw std::bad_alloc{};
+        }
+        block->owner = cache;
+        block->size_class = size_class;
+        return block + 1;
+    }
+
+    static void deallocate(void* p) noexcept {
+        auto block = static_cast<block_header*>(p) - 1;
+        auto owner = block->owner;
+        if (!owner) {
+            std::free(block);
+        } else if (owner == tls().cache) {
+            owner->push_local(block);
+        } else {
+            owner->remote_frees.fetch_add(1, std::memory_order_relaxed);
+            owner->push_remote(block);
+        }
+    }
+
+    static stats_type stats() noexcept {
+        stats_type result{0, 0, 0};
+        auto& caches = registry::instance();
+        std::lock_guard<std::mutex> lock{caches.mutex};
+        for (auto cache : caches.all) {
+            result.hits += cache->hits.load(std::memory_order_relaxed);
+            result.misses += cache->misses.load(std::memory_order_relaxed);
+            result.remote_frees += cache->remote_frees.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    struct thread_cache;
+
+    struct alignas(std::max_align_t) block_header final {
+        thread_cache* owner;
+        std::size_t size_class;
+        block_header* next;
+    };
+
+    struct thread_cache final {
+        block_header* pop(std::size_t size_class) noexcept {
+            if (!local[size_class]) {
+                auto remote_blocks = remote[size_class].value.exchange(nullptr, std::memory_order_acquire);
+                for (auto block = remote_blocks; block; block = block->next) {
+                    ++local_count[size_class];
+                }
+                local[size_class] = remote_blocks;
+            }
+            auto block = local[size_class];
+            if (block) {
+                local[size_class] = block->next;
+                --local_count[size_class];
+            }
+            return block;
+        }
+
+        void push_local(block_header* block) noexcept {
+            const auto size_class = block->size_class;
+            if (local_count[size_class] >= max_cached_blocks) {
+                std::free(block);
+                return;
+            }
+            block->next = local[size_class];
+            local[size_class] = block;
+            ++local_count[size_class];
+        }
+
+        void push_remote(block_header* block) noexcept {
+            auto& head = remote[block->size_class].value;
+            block->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(block->next, block, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+            }
+        }
+
+        // padded so remote frees of different classes do not share a cache line
+        struct remote_list final {
+            std::atomic<block_header*> value{nullptr};
+            char padding[64 - sizeof(std::atomic<block_header*>)];
+        };
+
+        block_header* local[class_count]{};
+        std::size_t local_count[class_count]{};
+        // written by the owner only, atomic so that stats() may read them
+        std::atomic<std::uint64_t> hits{0};
+        std::atomic<std::uint64_t> misses{0};
+        std::atomic<std::uint64_t> remote_frees{0};
+        remote_list remote[class_count];
+    };
+
+    // caches are never freed, a cache whose thread exited is adopted by the next new thread,
+    // so remote frees into it stay valid and its blocks are reused.
+    struct registry final {
+        static registry& instance() {
+            static auto caches = new registry{};
+            return *caches;
+        }
+
+        thread_cache* acquire() {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (!orphans.empty()) {
+                auto cache = orphans.back();
+                orphans.pop_back();
+                return cache;
+            }
+            all.push_back(new thread_cache{});
+            return all.back();
+        }
+
+        void abandon(thread_cache* cache) {
+            std::lock_guard<std::mutex> lock{mutex};
+            orphans.push_back(cache);
+        }
+
+        std::mutex mutex;
+        std::vector<thread_cache*> all;
+        std::vector<thread_cache*> orphans;
+    };
+
+    struct thread_state final {
+        ~thread_state() {
+            if (cache) {
+                registry::instance().abandon(cache);
+                cache = nullptr;
+            }
+            exited = true;
+        }
+
+        thread_cache* cache{nullptr};
+        bool exited{false};
+    };
+
+    static thread_state& tls() noexcept {
+        static thread_local thread_state state;
+        return state;
+    }
+
+    static thread_cache* local_cache() {
+        auto& state = tls();
+        if (!state.cache && !state.exited) {
+            state.cache = registry::instance().acquire();
+        }
+        return state.cache;
+    }
+
+    static std::size_t class_of(std::size_t size) noexcept {
+        std::size_t size_class{0};
+        while (size_class < class_count && (min_block_size << size_class) < size) {
+            ++size_class;
+        }
+        return size_class;
+    }
+
+    static std::size_t block_size(std::size_t size_class, std::size_t size) noexcept {
+        return size_class < class_count ? min_block_size << size_class : size;
+    }
+
+    static void increase(std::atomic<std::uint64_t>& counter) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// the reference count a completion state uses, atomic unless the promise is confined to one thread
+template <typename _Promise>
+struct state_base_of {
+    using type = shared_state_base;
+    using tally_type = callback_tally;
+};
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+struct state_base_of<local_awaitable_promise<_Ty>> {
+    using type = local_state_base;
+    using tally_type = local_callback_tally;
+};
+#endif // defined(ENABLE_CO_AWAIT)
+
+// the only allocation of a wrapped call, result, readiness and continuation live in _Promise
+template <typename _Promise, typename _Alloc>
+class completion_state final
+    : public state_base_of<_Promise>::type,
+      private std::allocator_traits<_Alloc>::template rebind_alloc<completion_state<_Promise, _Alloc>> {
+public:
+    using promise_type = _Promise;
+    using allocator_type =
+        typename std::allocator_traits<_Alloc>::template rebind_alloc<completion_state<_Promise, _Alloc>>;
+
+    template <typename... _Args>
+    static completion_state* create(const _Alloc& alloc, _Args&&... args) {
+        allocator_type allocator{alloc};
+        auto state = spare_block<allocator_type>::allocate(allocator);
+        try {
+            return ::new (static_cast<void*>(state)) completion_state{
+                allocator, std::uses_allocator<promise_type, allocator_type>{}, std::forward<_Args>(args)...};
+        } catch (...) {
+            spare_block<allocator_type>::deallocate(allocator, state);
+            throw;
+        }
+    }
+
+    promise_type* promise() noexcept {
+        return std::addressof(promise_);
+    }
+
+    // the callback protocol of completion_handler, each copy of the callback holds a reference
+
+    void add_callback() noexcept {
+        this->add_ref();
+        callbacks_.copy();
+    }
+
+    bool claim_callback() noexcept {
+        return callbacks_.fire();
+    }
+
+    void drop_callback() noexcept {
+        if (callbacks_.drop()) {
+            promise_.set_exception(broken_promise());
+        }
+        this->release();
+    }
+
+#if defined(ENABLE_INSTRUMENTATION)
+    call_record& record() noexcept {
+        return record_;
+    }
+#endif // defined(ENABLE_INSTRUMENTATION)
+
+private:
+    // std::promise allocates its own shared state, route it through the same allocator
+    template <typename... _Args>
+    completion_state(const allocator_type& allocator, std::true_type, _Args&&... args)
+        : allocator_type{allocator}, promise_{std::allocator_arg, allocator, std::forward<_Args>(args)...} {
+    }
+
+    template <typename... _Args>
+    completion_state(const allocator_type& allocator, std::false_type, _Args&&... args)
+        : allocator_type{allocator}, promise_{std::forward<_Args>(args)...} {
+    }
+
+    void destroy() noexcept override {
+#if defined(ENABLE_INSTRUMENTATION)
+        record_.abandon();
+#endif // defined(ENABLE_INSTRUMENTATION)
+        allocator_type allocator{static_cast<allocator_type&>(*this)};
+        this->~completion_state();
+        spare_block<allocator_type>::deallocate(allocator, this);
+        signal_future(holds_std_promise<promise_type>{});
+    }
+
+    static void signal_future(std::true_type) noexcept {
+        future_signal::instance().notify();
+    }
+
+    static void signal_future(std::false_type) noexcept {
+    }
+
+    typename state_base_of<_Promise>::tally_type callbacks_;
+    promise_type promise_;
+#if defined(ENABLE_INSTRUMENTATION)
+    call_record record_;
+#endif // defined(ENABLE_INSTRUMENTATION)
+};
+
+#if defined(ENABLE_INSTRUMENTATION)
+// only completion states are recorded, bulk slots and streams are not
+template <typename _State>
+void launch_call(_State*, call_site*) noexcept {
+}
+
+template <typename _Promise, typename _Alloc>
+void launch_call(completion_state<_Promise, _Alloc>* state, call_site* site) noexcept {
+    state->record().launch(site);
+}
+
+template <typename _State>
+void complete_call(_State*) noexcept {
+}
+
+template <typename _Promise, typename _Alloc>
+void complete_call(completion_state<_Promise, _Alloc>* state) noexcept {
+    state->record().complete();
+}
+#endif // defined(ENABLE_INSTRUMENTATION)
+
+// the callback of a state, each copy owns a reference. the first call of any copy completes the
+// state and later ones are dropped, the last copy destroyed without a call completes it with
+// std::future_errc::broken_promise. pointer sized and nothrow movable, std::function implementations
+// that only keep trivially copyable functors in their small buffer get its block from the pool.
+template <typename _State>
+class completion_handler final {
+public:
+    // adopts the reference the state holds for its callback
+    explicit completion_handler(_State* state) noexcept : state_{state} {
+    }
+
+    completion_handler(const completion_handler& rhs) noexcept : state_{rhs.state_} {
+        if (state_) {
+            state_->add_callback();
+        }
+    }
+
+    completion_handler(completion_handler&& rhs) noexcept : state_{rhs.state_} {
+        rhs.state_ = nullptr;
+    }
+
+    completion_handler& operator=(completion_handler rhs) noexcept {
+        std::swap(state_, rhs.state_);
+        return *this;
+    }
+
+    ~completion_handler() {
+        if (state_) {
+            state_->drop_callback();
+        }
+    }
+
+    template <typename... _Args>
+    void operator()(_Args&&... args) const {
+        if (!state_->claim_callback()) {
+            return;
+        }
+#if defined(ENABLE_INSTRUMENTATION)
+        complete_call(state_);
+#endif // defined(ENABLE_INSTRUMENTATION)
+        apply_callback(state_->promise(), std::forward<_Args>(args)...);
+    }
+
+    static void* operator new(std::size_t size) {
+        return recycling_pool::allocate(size);
+    }
+
+    static void operator delete(void* p) noexcept {
+        recycling_pool::deallocate(p);
+    }
+
+private:
+    _State* state_;
+};
+
+// the callback of a state that stays in place until it completes, like the operation state of a
+// deferred call. trivially copyable and holds no reference, so it must be called exactly once.
+template <typename _State>
+class borrowed_handler final {
+public:
+    explicit borrowed_handler(_State* state) noexcept : state_{state} {
+    }
+
+    template <typename... _Args>
+    void operator()(_Args&&... args) const {
+        apply_callback(state_->promise(), std::forward<_Args>(args)...);
+    }
+
+private:
+    _State* state_;
+};
+
+template <typename _Callback>
+using callback_result_t = typename function_args<_Callback>::args_tuple;
+
+// the concrete callback of a state, overloaded for states that are no completion_state
+template <typename _State>
+completion_handler<_State> make_handler(_State* state) noexcept {
+    return completion_handler<_State>{state};
+}
+
+template <typename _Callback, typename _State>
+auto make_callback(_State* state) {
+    return typename function_args<_Callback>::function_type{make_handler(state)};
+}
+
+template <typename _Ty, typename = void>
+struct has_call_signature : std::false_type {};
+
+template <typename _Ty>
+struct has_call_signature<_Ty, decltype(void(&_Ty::operator()))> : std::true_type {};
+
+template <typename _Ret, typename... _Args>
+struct has_call_signature<_Ret(_Args...)> : std::true_type {};
+
+template <typename _Ret, typename... _Args>
+struct has_call_signature<_Ret (*)(_Args...)> : std::true_type {};
+
+template <typename _Ty, std::size_t _Index, bool = has_call_signature<_Ty>{}>
+struct callee_callback {
+    using type = typename function_args<_Ty>::template arg_t<_Index>;
+};
+
+template <typename _Ty, std::size_t _Index>
+struct callee_callback<_Ty, _Index, false> {
+    static_assert(has_call_signature<_Ty>{},
+                  "the callee takes a deduced handler, name the callback signature: async_wrapper<void(int)>(...)");
+    using type = void();
+};
+
+// the callback type from the callee's parameter, or the signature given for a generic callee
+template <typename _Signature, typename _Func, std::size_t _Index>
+struct callback_type {
+    using type = _Signature;
+};
+
+template <typename _Func, std::size_t _Index>
+struct callback_type<void, _Func, _Index> {
+    using type = typename callee_callback<std::decay_t<_Func>, _Index>::type;
+};
+
+template <typename... _Args>
+struct user_data_index;
+
+template <>
+struct user_data_index<> : std::integral_constant<std::size_t, 0> {};
+
+template <typename _Arg, typename... _Args>
+struct user_data_index<_Arg, _Args...>
+    : std::integral_constant<std::size_t, std::is_same<std::decay_t<_Arg>, void*>{}
+                                              ? 0
+                                              : 1 + user_data_index<_Args...>{}> {};
+
+// the index of argument _Index of a callback once the one at _Skip is left out
+template <std::size_t _Index, std::size_t _Skip>
+using skip_index = std::integral_constant<std::size_t, (_Index < _Skip ? _Index : _Index + 1)>;
+
+template <typename _Ret, typename _Args, std::size_t _Skip, typename _Indexes>
+struct signature_without;
+
+template <typename _Ret, typename... _Args, std::size_t _Skip, std::size_t... _Indexes>
+struct signature_without<_Ret, std::tuple<_Args...>, _Skip, std::index_sequence<_Indexes...>> {
+    using type = _Ret(typename std::tuple_element<skip_index<_Indexes, _Skip>{}, std::tuple<_Args...>>::type...);
+};
+
+// what the call completes with, the arguments of the callback except the user data of a C callback
+template <typename _Callback>
+struct completion_signature {
+    using type = _Callback;
+};
+
+template <typename _Ret, typename... _Args>
+struct completion_signature<_Ret (*)(_Args...)> {
+    static constexpr std::size_t user_index{user_data_index<_Args...>{}};
+    static_assert(user_index < sizeof...(_Args), "a C callback needs a void* parameter for the user data");
+    using type = typename signature_without<void, std::tuple<_Args...>, user_index,
+                                            std::make_index_sequence<sizeof...(_Args) - 1>>::type;
+};
+
+template <typename _Callback>
+using completion_signature_t = typename completion_signature<_Callback>::type;
+
+template <typename _Function, typename _State>
+class c_callback;
+
+// a C callback: the placeholder becomes a pointer to invoke, placeholder::user_data the state.
+// invoke is generated per callback and state type, so nothing is allocated or type erased.
+// the user data carries the callback's reference, so the C API has to call back exactly once.
+template <typename _Ret, typename... _Args, typename _State>
+class c_callback<_Ret (*)(_Args...), _State> final {
+public:
+    explicit c_callback(_State* state) noexcept : state_{state} {
+    }
+
+    _Ret (*function() const noexcept)(_Args...) {
+        return &invoke;
+    }
+
+    void* user_data() const noexcept {
+        return state_;
+    }
+
+private:
+    static constexpr std::size_t user_index{completion_signature<_Ret (*)(_Args...)>::user_index};
+
+    // must not throw into C
+    static _Ret invoke(_Args... args) noexcept {
+        call(std::forward_as_tuple(std::forward<_Args>(args)...), std::make_index_sequence<sizeof...(_Args) - 1>{});
+        return _Ret();
+    }
+
+    template <std::size_t... _Indexes>
+    static void call(std::tuple<_Args&&...> args, std::index_sequence<_Indexes...>) {
+        auto state = static_cast<_State*>(std::get<user_index>(args));
+        make_handler(state)(std::get<skip_index<_Indexes, user_index>{}>(std::move(args))...);
+    }
+
+    _State* state_;
+};
+
+template <typename _Placeholder, typename _Function, typename _State>
+auto substitute_placeholder(const _Placeholder&, const c_callback<_Function, _State>& callback) {
+    return callback.function();
+}
+
+template <typename _Function, typename _State>
+void* substitute_placeholder(placeholder_user_data_t, const c_callback<_Function, _State>& callback) {
+    return callback.user_data();
+}
+
+template <typename _Callback, typename _State>
+auto make_declared_callback(_State* state, std::true_type) {
+    return c_callback<_Callback, _State>{state};
+}
+
+template <typename _Callback, typename _State>
+auto make_declared_callback(_State* state, std::false_type) {
+    return make_callback<_Callback>(state);
+}
+
+// std::function where the callee declares one, a trampoline where it takes a C function pointer,
+// otherwise the handler itself, so the callee instantiates on it and the call inlines down to the promise
+template <typename _Callback, typename _State>
+auto make_callee_callback(_State* state, std::true_type) {
+    return make_declared_callback<_Callback>(state, std::is_pointer<_Callback>{});
+}
+
+template <typename _Callback, typename _State>
+auto make_callee_callback(_State* state, std::false_type) {
+    return make_handler(state);
+}
+
+// make_completion creates the completion state for a placeholder and the future handed to the caller
+
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc& alloc, placeholder_std_future_t) {
+    auto state = completion_state<std::promise<callback_result_t<_Callback>>, _Alloc>::create(alloc);
+    return std::make_pair(state, state->promise()->get_future());
+}
+
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc& alloc, placeholder_continuable_t) {
+    auto state = completion_state<continuable_promise<callback_result_t<_Callback>>, _Alloc>::create(alloc);
+    // one reference for the callback, one for the future
+    state->add_ref();
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc& alloc, placeholder_blocking_t placeholder) {
+    auto state = completion_state<blocking_promise<callback_result_t<_Callback>>, _Alloc>::create(alloc,
+                                                                                                  placeholder.max_spins);
+    state->add_ref();
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc& alloc, placeholder_awaitable_t) {
+    auto state = completion_state<awaitable_promise<callback_result_t<_Callback>>, _Alloc>::create(alloc);
+    // one reference for the callback, one for the future
+    state->add_ref();
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc& alloc, placeholder_awaitable_st_t) {
+    auto state = completion_state<local_awaitable_promise<callback_result_t<_Callback>>, _Alloc>::create(alloc);
+    state->add_ref();
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+template <typename _Callback, typename _Alloc, typename _Executor, bool _Inline>
+auto make_completion(const _Alloc& alloc, const placeholder_awaitable_on_t<_Executor, _Inline>& placeholder) {
+    using promise_t = awaitable_promise_on<callback_result_t<_Callback>, _Executor, _Inline>;
+    auto state = completion_state<promise_t, _Alloc>::create(alloc, static_cast<_Executor>(placeholder.executor));
+    state->add_ref();
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+// hierarchical timer wheel served by one shared thread, levels of 64 slots with a 1ms tick.
+// timers are intrusive, scheduling and cancelling is O(1) under one mutex, the thread sleeps
+// until the next occupied slot of the lowest level or the next cascade. retiring a timer never
+// waits for the lock: it is unlinked at once, or by the thread holding the lock before it lets go.
+class timer_wheel final {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct timer {
+        // called on the wheel thread, without the lock held
+        void (*fire)(timer*);
+        // called once a retired timer is out of the wheel, without the lock held
+        void (*drop)(timer*);
+        timer* prev{nullptr};
+        timer* next{nullptr};
+        // links the retired timers not unlinked yet
+        timer* retired_next{nullptr};
+        std::uint64_t expiry{0};
+        std::size_t level{0};
+        std::atomic<std::uint32_t> phase{0};
+    };
+
+    static timer_wheel& instance() {
+        static auto wheel = new timer_wheel{};
+        return *wheel;
+    }
+
+    void schedule(timer* node, clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock{mutex_};
+        if (!thread_started_) {
+            std::thread{[this]() { run(); }}.detach();
+            thread_started_ = true;
+        }
+        if (!count_) {
+            // nothing to cascade, skip the idle ticks
+            current_ = std::max(current_, tick_of(clock::now()));
+        }
+        node->expiry = std::max(tick_of(deadline), current_ + 1);
+        insert(node);
+        ++count_;
+        node->phase.store(armed, std::memory_order_release);
+        const auto notify = node->expiry < wake_tick_;
+        unlock(lock);
+        if (notify) {
+            wake_.notify_one();
+        }
+    }
+
+    // false if node fired or is firing, or was retired
+    bool cancel(timer* node) noexcept {
+        std::unique_lock<std::mutex> lock{mutex_};
+        auto expected = armed;
+        const auto cancelled = node->phase.compare_exchange_strong(expected, idle, std::memory_order_acq_rel,
+                                                                   std::memory_order_relaxed);
+        if (cancelled) {
+            unlink(node);
+            --count_;
+        }
+        unlock(lock);
+        return cancelled;
+    }
+
+    // cancels without the lock, node->drop is called later instead. false if node fired or is firing,
+    // or was never scheduled
+    bool retire(timer* node) noexcept {
+        auto expected = armed;
+        if (!node->phase.compare_exchange_strong(expected, retired, std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed)) {
+            return false;
+        }
+        auto head = retired_.load(std::memory_order_relaxed);
+        do {
+            node->retired_next = head;
+        } while (!retired_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        reclaim();
+        return true;
+    }
+
+private:
+    static constexpr std::uint32_t idle{0};
+    static constexpr std::uint32_t armed{1};
+    static constexpr std::uint32_t fired{2};
+    static constexpr std::uint32_t retired{3};
+
+    static constexpr std::size_t level_count{6};
+    static constexpr std::size_t slot_bits{6};
+    static constexpr std::size_t slot_count{1 << slot_bits};
+    static constexpr std::uint64_t slot_mask{slot_count - 1};
+    static constexpr std::uint64_t never{static_cast<std::uint64_t>(-1)};
+
+    struct level final {
+        timer slots[slot_count];
+        std::uint64_t occupied{0};
+    };
+
+    timer_wheel() {
+        for (auto& level : levels_) {
+            for (auto& slot : level.slots) {
+                slot.prev = &slot;
+                slot.next = &slot;
+            }
+        }
+    }
+
+    // rounded up, a timer never fires early
+    static std::uint64_t tick_of(clock::time_point time_point) noexcept {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time_point.time_since_epoch() +
+                                                                              std::chrono::milliseconds{1} -
+                                                                              clock::duration{1});
+        return static_cast<std::uint64_t>(std::max<std::chrono::milliseconds::rep>(ms.count(), 0));
+    }
+
+    void insert(timer* node) noexcept {
+        const auto delta = node->expiry > current_ ? node->expiry - current_ : 0;
+        std::size_t index{0};
+        while (index + 1 < level_count && delta >> (slot_bits * (index + 1))) {
+            ++index;
+        }
+        auto& level = levels_[index];
+        const auto slot = (node->expiry >> (slot_bits * index)) & slot_mask;
+        auto& head = level.slots[slot];
+        node->level = index;
+        node->prev = head.prev;
+        node->next = &head;
+        head.prev->next = node;
+        head.prev = node;
+        level.occupied |= std::uint64_t{1} << slot;
+    }
+
+    void unlink(timer* node) noexcept {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (node->next == node->prev) {
+            // only the sentinel is left
+            const auto slot = (node->expiry >> (slot_bits * node->level)) & slot_mask;
+            levels_[node->level].occupied &= ~(std::uint64_t{1} << slot);
+        }
+        node->prev = nullptr;
+        node->next = nullptr;
+    }
+
+    // moves the timers of a slot out, re-inserted or fired by the caller
+    timer* take(std::size_t index, std::size_t slot) noexcept {
+        auto& level = levels_[index];
+        auto& head = level.slots[slot];
+        timer* list{nullptr};
+        while (head.next != &head) {
+            auto node = head.next;
+            unlink(node);
+            node->next = list;
+            list = node;
+        }
+        return list;
+    }
+
+    // processes one tick, the expired timers are chained through next
+    timer* advance() noexcept {
+        ++current_;
+        for (std::size_t index = 1; index < level_count; ++index) {
+            const auto slot = (current_ >> (slot_bits * (index - 1))) & slot_mask;
+            if (slot) {
+                break;
+            }
+            auto list = take(index, (current_ >> (slot_bits * index)) & slot_mask);
+            while (list) {
+                auto node = list;
+                list = list->next;
+                insert(node);
+            }
+        }
+        auto list = take(0, current_ & slot_mask);
+        timer* expired{nullptr};
+        while (list) {
+            auto node = list;
+            list = list->next;
+            --count_;
+            // a retired timer is left to drain(), which finds it unlinked
+            auto expected = armed;
+            if (node->phase.compare_exchange_strong(expected, fired, std::memory_order_acq_rel,
+                                                    std::memory_order_relaxed)) {
+                node->next = expired;
+                expired = node;
+            } else {
+                node->next = nullptr;
+            }
+        }
+        return expired;
+    }
+
+    // unlinks the retired timers, returned to be dropped once the lock is released
+    timer* drain() noexcept {
+        auto list = retired_.exchange(nullptr, std::memory_order_acquire);
+        for (auto node = list; node; node = node->retired_next) {
+            if (node->prev) {
+                unlink(node);
+                --count_;
+            }
+        }
+        return list;
+    }
+
+    // drains before letting go of the lock, then takes what was retired meanwhile
+    void unlock(std::unique_lock<std::mutex>& lock) noexcept {
+        auto retired = drain();
+        lock.unlock();
+        drop(retired);
+        reclaim();
+    }
+
+    // a holder of the lock drains before it lets go, the wheel thread is woken in case it is the holder
+    // about to sleep
+    void reclaim() noexcept {
+        while (retired_.load(std::memory_order_relaxed)) {
+            if (!mutex_.try_lock()) {
+                wake_.notify_one();
+                return;
+            }
+            auto retired = drain();
+            mutex_.unlock();
+            drop(retired);
+        }
+    }
+
+    // drop may free the memory of its timer
+    static void drop(timer* list) noexcept {
+        while (list) {
+            auto node = list;
+            list = list->retired_next;
+            node->drop(node);
+        }
+    }
+
+    std::uint64_t next_tick() const noexcept {
+        if (!count_) {
+            return never;
+        }
+        // the next cascade, or earlier if the lowest level has something before it
+        const auto cascade = (current_ | slot_mask) + 1;
+        const auto occupied = levels_[0].occupied;
+        for (auto tick = current_ + 1; tick < cascade; ++tick) {
+            if (occupied & (std::uint64_t{1} << (tick & slot_mask))) {
+                return tick;
+            }
+        }
+        return cascade;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock{mutex_};
+        for (;;) {
+            if (auto retired = drain()) {
+                lock.unlock();
+                drop(retired);
+                lock.lock();
+                continue;
+            }
+            const auto now = tick_of(clock::now());
+            timer* expired{nullptr};
+            while (count_ && current_ < now && !expired) {
+                expired = advance();
+            }
+            if (expired) {
+                unlock(lock);
+                while (expired) {
+                    auto node = expired;
+                    expired = expired->next;
+                    node->next = nullptr;
+                    node->fire(node);
+                }
+                lock.lock();
+                continue;
+            }
+            if (!count_) {
+                current_ = std::max(current_, now);
+            }
+            // retired while this thread held the lock, see reclaim()
+            if (retired_.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            wake_tick_ = next_tick();
+            if (wake_tick_ == never) {
+                wake_.wait(lock);
+            } else {
+                wake_.wait_until(lock, clock::time_point{std::chrono::milliseconds{wake_tick_}});
+            }
+            wake_tick_ = 0;
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    level levels_[level_count];
+    std::uint64_t current_{0};
+    std::uint64_t wake_tick_{0};
+    std::size_t count_{0};
+    bool thread_started_{false};
+    std::atomic<timer*> retired_{nullptr};
+};
+
+template <typename _Ty>
+std::future<_Ty> future_of(std::promise<_Ty>& promise, shared_state_base*) {
+    return promise.get_future();
+}
+
+template <typename _Ty>
+continuable_future<_Ty> future_of(continuable_promise<_Ty>& promise, shared_state_base* owner) {
+    owner->add_ref();
+    return promise.get_future(owner);
+}
+
+template <typename _Ty>
+blocking_future<_Ty> future_of(blocking_promise<_Ty>& promise, shared_state_base* owner) {
+    owner->add_ref();
+    return promise.get_future(owner);
+}
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+awaitable_future<_Ty> future_of(awaitable_promise<_Ty>& promise, shared_state_base* owner) {
+    owner->add_ref();
+    return promise.get_future(owner);
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+template <typename _Result>
+struct expected_of {
+    static_assert(!std::is_void<_Result>{}, "as_expected needs a callback taking the error first");
+    using type = expected<void, _Result>;
+};
+
+template <typename _Error, typename _Arg>
+struct expected_of<std::tuple<_Error, _Arg>> {
+    using type = expected<_Arg, _Error>;
+};
+
+template <typename _Error, typename _Arg0, typename _Arg1, typename... _Args>
+struct expected_of<std::tuple<_Error, _Arg0, _Arg1, _Args...>> {
+    using type = expected<std::tuple<_Arg0, _Arg1, _Args...>, _Error>;
+};
+
+// the expected for the results of a callback, as callback_result_t gives them
+template <typename _Result>
+using expected_of_t = typename expected_of<_Result>::type;
+
+template <typename _Result, typename _Promise, typename... _Args>
+auto emplace_result(_Promise& promise, int, _Args&&... args)
+    -> decltype(promise.emplace_value(std::forward<_Args>(args)...)) {
+    return promise.emplace_value(std::forward<_Args>(args)...);
+}
+
+template <typename _Result, typename _Promise, typename... _Args>
+void emplace_result(_Promise& promise, long, _Args&&... args) {
+    promise.set_value(_Result(std::forward<_Args>(args)...));
+}
+
+// wraps the promise of a placeholder completed with _Expected, splits the callback arguments into
+// error and value. the result is constructed in place where the promise allows, no exception is involved.
+template <typename _Promise, typename _Expected>
+class expected_promise final {
+public:
+    using error_type = typename _Expected::error_type;
+
+    template <typename... _Args>
+    explicit expected_promise(_Args&&... args) : promise_{std::forward<_Args>(args)...} {
+    }
+
+    auto get_future(shared_state_base* owner) {
+        return future_of(promise_, owner);
+    }
+
+    template <typename _Error, typename... _Args>
+    void emplace_value(_Error&& error, _Args&&... args) {
+        if (error) {
+            emplace_result<_Expected>(promise_, 0, unexpect, std::forward<_Error>(error));
+        } else {
+            emplace_result<_Expected>(promise_, 0, in_place, std::forward<_Args>(args)...);
+        }
+    }
+
+    void set_exception(std::exception_ptr exception) {
+        promise_.set_exception(std::move(exception));
+    }
+
+    // a deadline or stop request, as error where error_type takes an error_code
+    void cancel(std::errc error) {
+        cancel(error, std::is_constructible<error_type, std::error_code>{});
+    }
+
+private:
+    void cancel(std::errc error, std::true_type) {
+        emplace_result<_Expected>(promise_, 0, unexpect, std::make_error_code(error));
+    }
+
+    void cancel(std::errc error, std::false_type) {
+        set_exception(std::make_exception_ptr(std::system_error{std::make_error_code(error)}));
+    }
+
+    _Promise promise_;
+};
+
+template <typename _Promise, typename _Expected>
+auto future_of(expected_promise<_Promise, _Expected>& promise, shared_state_base* owner) {
+    return promise.get_future(owner);
+}
+
+// how a placeholder completes on a deadline or stop request
+template <typename _Promise>
+void complete_cancelled(_Promise& promise, std::errc error) {
+    promise.set_exception(std::make_exception_ptr(std::system_error{std::make_error_code(error)}));
+}
+
+template <typename _Promise, typename _Expected>
+void complete_cancelled(expected_promise<_Promise, _Expected>& promise, std::errc error) {
+    promise.cancel(error);
+}
+
+// wraps the promise of a placeholder, whoever claims it first of the callback, the deadline and the
+// stop request completes it. the armed timer and stop registration each hold a reference to the
+// completion state, so a late callback costs one failed exchange and never sees freed memory.
+// claiming retires the timer without taking the wheel's lock, the wheel drops its reference later.
+template <typename _Promise>
+class cancellable_promise final : private timer_wheel::timer, private stop_state::registration {
+public:
+    template <typename... _Args>
+    explicit cancellable_promise(_Args&&... args)
+        : timer_wheel::timer{&on_deadline, &on_dropped},
+          stop_state::registration{&on_stop},
+          promise_{std::forward<_Args>(args)...} {
+    }
+
+    auto get_future(shared_state_base* owner) {
+        return future_of(promise_, owner);
+    }
+
+    template <typename _Placeholder>
+    void arm(shared_state_base* owner, const placeholder_cancellable_t<_Placeholder>& placeholder) {
+        // claim() may run as soon as one of both is registered and reads these
+        owner_ = owner;
+        stop_ = placeholder.token.state_;
+        timer_armed_ = placeholder.deadline != std::chrono::steady_clock::time_point::max();
+        // a claim racing with a registration may miss it, so each one checks for a claim afterwards
+        if (stop_) {
+            owner_->add_ref();
+            if (!stop_->add(this)) {
+                owner_->release();
+                cancel(std::errc::operation_canceled);
+            } else if (claimed_.load(std::memory_order_acquire) && stop_->remove(this)) {
+                owner_->release();
+            }
+        }
+        if (timer_armed_) {
+            owner_->add_ref();
+            timer_wheel::instance().schedule(this, placeholder.deadline);
+            if (claimed_.load(std::memory_order_acquire) && timer_wheel::instance().cancel(this)) {
+                owner_->release();
+            }
+        }
+    }
+
+    template <typename... _Args>
+    void set_value(_Args&&... args) {
+        if (claim()) {
+            promise_.set_value(std::forward<_Args>(args)...);
+        }
+    }
+
+    // the wrapped promise still builds its result in place if it can
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        if (claim()) {
+            apply_callback(std::addressof(promise_), std::forward<_Args>(args)...);
+        }
+    }
+
+    void set_exception(std::exception_ptr exception) {
+        if (claim()) {
+            promise_.set_exception(std::move(exception));
+        }
+    }
+
+private:
+    bool claim() noexcept {
+        if (claimed_.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        if (timer_armed_) {
+            timer_wheel::instance().retire(this);
+        }
+        if (stop_ && stop_->remove(this)) {
+            owner_->release();
+        }
+        return true;
+    }
+
+    void cancel(std::errc error) {
+        if (claim()) {
+            complete_cancelled(promise_, error);
+        }
+    }
+
+    static void on_deadline(timer_wheel::timer* node) {
+        auto self = static_cast<cancellable_promise*>(node);
+        auto owner = self->owner_;
+        self->cancel(std::errc::timed_out);
+        owner->release();
+    }
+
+    static void on_dropped(timer_wheel::timer* node) {
+        static_cast<cancellable_promise*>(node)->owner_->release();
+    }
+
+    static void on_stop(stop_state::registration* node) {
+        auto self = static_cast<cancellable_promise*>(node);
+        auto owner = self->owner_;
+        self->cancel(std::errc::operation_canceled);
+        owner->release();
+    }
+
+    _Promise promise_;
+    shared_state_base* owner_{nullptr};
+    std::shared_ptr<stop_state> stop_;
+    bool timer_armed_{false};
+    std::atomic_bool claimed_{false};
+};
+
+// the promise a placeholder completes for a result of type _Ty, and how to create the state holding it
+template <typename _Ty, typename _Placeholder>
+struct placeholder_promise;
+
+template <typename _Ty>
+struct placeholder_promise<_Ty, placeholder_std_future_t> {
+    using promise_type = std::promise<_Ty>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, placeholder_std_future_t) {
+        return _State::create(alloc);
+    }
+};
+
+template <typename _Ty>
+struct placeholder_promise<_Ty, placeholder_blocking_t> {
+    using promise_type = blocking_promise<_Ty>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, placeholder_blocking_t placeholder) {
+        return _State::create(alloc, placeholder.max_spins);
+    }
+};
+
+template <typename _Ty>
+struct placeholder_promise<_Ty, placeholder_continuable_t> {
+    using promise_type = continuable_promise<_Ty>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, placeholder_continuable_t) {
+        return _State::create(alloc);
+    }
+};
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+struct placeholder_promise<_Ty, placeholder_awaitable_t> {
+    using promise_type = awaitable_promise<_Ty>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, placeholder_awaitable_t) {
+        return _State::create(alloc);
+    }
+};
+
+template <typename _Ty, typename _Executor, bool _Inline>
+struct placeholder_promise<_Ty, placeholder_awaitable_on_t<_Executor, _Inline>> {
+    using promise_type = awaitable_promise_on<_Ty, _Executor, _Inline>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, const placeholder_awaitable_on_t<_Executor, _Inline>& placeholder) {
+        return _State::create(alloc, static_cast<_Executor>(placeholder.executor));
+    }
+};
+#endif // defined(ENABLE_CO_AWAIT)
+
+template <typename _Ty, typename _Placeholder>
+struct placeholder_promise<_Ty, placeholder_expected_t<_Placeholder>> {
+    using result_type = expected_of_t<_Ty>;
+    using inner_type = placeholder_promise<result_type, _Placeholder>;
+    using promise_type = expected_promise<typename inner_type::promise_type, result_type>;
+
+    template <typename _State, typename _Alloc>
+    static _State* create(const _Alloc& alloc, const placeholder_expected_t<_Placeholder>& placeholder) {
+        return inner_type::template create<_State>(alloc, placeholder.placeholder);
+    }
+};
+
+template <typename _Callback, typename _Alloc, typename _Placeholder>
+auto make_completion(const _Alloc& alloc, const placeholder_expected_t<_Placeholder>& placeholder) {
+    using completion_t = placeholder_promise<callback_result_t<_Callback>, placeholder_expected_t<_Placeholder>>;
+    using state_t = completion_state<typename completion_t::promise_type, _Alloc>;
+    auto state = completion_t::template create<state_t>(alloc, placeholder);
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+template <typename _Callback, typename _Alloc, typename _Placeholder>
+auto make_completion(const _Alloc& alloc, const placeholder_cancellable_t<_Placeholder>& placeholder) {
+    using completion_t = placeholder_promise<callback_result_t<_Callback>, _Placeholder>;
+    using state_t = completion_state<cancellable_promise<typename completion_t::promise_type>, _Alloc>;
+    auto state = completion_t::template create<state_t>(alloc, placeholder.placeholder);
+    auto future = state->promise()->get_future(state);
+    state->promise()->arm(state, placeholder);
+    return std::make_pair(state, std::move(future));
+}
+
+// wraps the promise of a placeholder::limited call, returns the permit before completing it,
+// so a waiter can start its call while the result travels on
+template <typename _Promise>
+class limited_promise final {
+public:
+    template <typename... _Args>
+    explicit limited_promise(_Args&&... args) : promise_{std::forward<_Args>(args)...} {
+    }
+
+    auto get_future(shared_state_base* owner) {
+        return future_of(promise_, owner);
+    }
+
+    void bind(async_semaphore* semaphore) noexcept {
+        semaphore_ = semaphore;
+    }
+
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        semaphore_->release();
+        apply_callback(std::addressof(promise_), std::forward<_Args>(args)...);
+    }
+
+    void set_exception(std::exception_ptr exception) {
+        semaphore_->release();
+        promise_.set_exception(std::move(exception));
+    }
+
+private:
+    _Promise promise_;
+    async_semaphore* semaphore_{nullptr};
+};
+
+template <typename _Callback, typename _Alloc, typename _Placeholder>
+auto make_completion(const _Alloc& alloc, const placeholder_limited_t<_Placeholder>& placeholder) {
+    using completion_t = placeholder_promise<callback_result_t<_Callback>, _Placeholder>;
+    using state_t = completion_state<limited_promise<typename completion_t::promise_type>, _Alloc>;
+    auto state = completion_t::template create<state_t>(alloc, placeholder.placeholder);
+    state->promise()->bind(placeholder.semaphore);
+    return std::make_pair(state, state->promise()->get_future(state));
+}
+
+// calls func with the arguments holding a callback of state. a copy of the callback is kept meanwhile,
+// so a func that throws completes the call with its exception, even if it dropped its own copy.
+template <typename _State, typename _Func, typename _Args>
+void call_callee(_State* state, _Func&& func, _Args&& args) {
+    state->add_callback();
+    const completion_handler<_State> kept{state};
+    try {
+        detail::apply(std::move(args), std::forward<_Func>(func));
+    } catch (...) {
+        if (state->claim_callback()) {
+            state->promise()->set_exception(std::current_exception());
+        }
+        throw;
+    }
+}
+
+// a placeholder::limited call waiting for its permit, func and its arguments with the callback in
+// place of the placeholder are kept until the permit is granted, allocated with the call's alloc.
+// its type depends on the state's through the callback, so it cannot live in the completion state,
+// only calls that have to queue allocate it.
+template <typename _State, typename _Alloc, typename _Func, typename _Args>
+class pending_call final
+    : semaphore_waiter,
+      private std::allocator_traits<_Alloc>::template rebind_alloc<pending_call<_State, _Alloc, _Func, _Args>> {
+public:
+    using allocator_type = typename std::allocator_traits<_Alloc>::template rebind_alloc<pending_call>;
+
+    static pending_call* create(const _Alloc& alloc, _State* state, _Func&& func, _Args&& args) {
+        allocator_type allocator{alloc};
+        auto call = std::allocator_traits<allocator_type>::allocate(allocator, 1);
+        try {
+            return ::new (static_cast<void*>(call)) pending_call{allocator, state, std::move(func), std::move(args)};
+        } catch (...) {
+            std::allocator_traits<allocator_type>::deallocate(allocator, call, 1);
+            throw;
+        }
+    }
+
+    semaphore_waiter* waiter() noexcept {
+        return this;
+    }
+
+    // starts the call and frees this, a throwing func completes the call with its exception
+    static void start(pending_call* self) noexcept {
+        auto state = self->state_;
+        try {
+            auto func = std::move(self->func_);
+            auto args = std::move(self->args_);
+            allocator_type allocator{std::move(*static_cast<allocator_type*>(self))};
+            self->~pending_call();
+            std::allocator_traits<allocator_type>::deallocate(allocator, self, 1);
+            call_callee(state, std::move(func), std::move(args));
+        } catch (...) {
+        }
+    }
+
+private:
+    pending_call(const allocator_type& allocator, _State* state, _Func&& func, _Args&& args)
+        : semaphore_waiter{&granted}, allocator_type{allocator}, state_{state}, func_{std::move(func)},
+          args_{std::move(args)} {
+    }
+
+    static void granted(semaphore_waiter* node) {
+        start(static_cast<pending_call*>(node));
+    }
+
+    _State* state_;
+    _Func func_;
+    _Args args_;
+};
+
+template <typename _Future>
+struct is_std_future : std::false_type {};
+
+template <typename _Ty>
+struct is_std_future<std::future<_Ty>> : std::true_type {};
+
+// calls func with the arguments, once the call holds its permit when the placeholder is limited
+// a std::future is waited for by blocking anyway, so its caller waits for the permit the same way
+template <typename _Alloc, typename _State, typename _Func, typename _Args>
+void start_limited_call(std::true_type, async_semaphore* semaphore, const _Alloc&, _State* state, _Func&& func,
+                        _Args&& args) {
+    semaphore->acquire_blocking();
+    call_callee(state, std::forward<_Func>(func), std::move(args));
+}
+
+// the caller may be the thread that has to release a permit, so it never waits for one
+template <typename _Alloc, typename _State, typename _Func, typename _Args>
+void start_limited_call(std::false_type, async_semaphore* semaphore, const _Alloc& alloc, _State* state,
+                        _Func&& func, _Args&& args) {
+    if (semaphore->try_acquire()) {
+        call_callee(state, std::forward<_Func>(func), std::move(args));
+        return;
+    }
+    using call_t = pending_call<_State, _Alloc, std::decay_t<_Func>, _Args>;
+    auto call = call_t::create(alloc, state, std::decay_t<_Func>{std::forward<_Func>(func)}, std::move(args));
+    if (semaphore->acquire_or_wait(call->waiter())) {
+        call_t::start(call);
+    }
+}
+
+// calls func with the arguments, once the call holds its permit when the placeholder is limited
+template <typename _Future, typename _Placeholder, typename _Alloc, typename _State, typename _Func, typename _Args>
+void start_call(const _Placeholder&, const _Alloc&, _State* state, _Func&& func, _Args&& args) {
+    call_callee(state, std::forward<_Func>(func), std::move(args));
+}
+
+template <typename _Future, typename _Placeholder, typename _Alloc, typename _State, typename _Func, typename _Args>
+void start_call(const placeholder_limited_t<_Placeholder>& placeholder, const _Alloc& alloc, _State* state,
+                _Func&& func, _Args&& args) {
+    start_limited_call(is_std_future<_Future>{}, placeholder.semaphore, alloc, state, std::forward<_Func>(func),
+                       std::move(args));
+}
+
+struct no_inline_call_scope final {};
+
+// only awaitable futures hold a result inline
+template <typename _Future>
+no_inline_call_scope make_inline_call_scope(_Future&) noexcept {
+    return {};
+}
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+inline_call_scope<_Ty> make_inline_call_scope(awaitable_future<_Ty>& future) noexcept {
+    return inline_call_scope<_Ty>{future};
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+// how a deferred call gets its permit, the plain one needs none
+template <typename _Derived, typename _Placeholder>
+class deferred_permit {
+protected:
+    bool acquire_permit(const _Placeholder&) noexcept {
+        return true;
+    }
+
+    void release_permit() noexcept {
+    }
+};
+
+// placeholder::limited(semaphore, placeholder::deferred), the operation state waits in the queue
+// itself and the call starts on the thread handing over the permit
+template <typename _Derived>
+class deferred_permit<_Derived, placeholder_limited_t<placeholder_deferred_t>> : semaphore_waiter {
+protected:
+    deferred_permit() noexcept : semaphore_waiter{&granted} {
+    }
+
+    deferred_permit(deferred_permit&& rhs) noexcept : semaphore_waiter{&granted} {
+        (void)rhs;
+    }
+
+    bool acquire_permit(const placeholder_limited_t<placeholder_deferred_t>& placeholder) noexcept {
+        semaphore_ = placeholder.semaphore;
+        return semaphore_->acquire_or_wait(this);
+    }
+
+    void release_permit() noexcept {
+        semaphore_->release();
+    }
+
+private:
+    static void granted(semaphore_waiter* node) {
+        static_cast<_Derived*>(static_cast<deferred_permit*>(node))->run();
+    }
+
+    async_semaphore* semaphore_{nullptr};
+};
+
+template <typename _Args>
+using deferred_placeholder_t = std::tuple_element_t<placeholder_index<_Args>{}, _Args>;
+
+// the operation state of a placeholder::deferred call connected to a receiver. nothing is allocated,
+// the callback points at this object, so it must stay in place from start() until completion.
+// the receiver gets set_value with the callback arguments, or set_error if func throws.
+template <typename _Signature, typename _Func, typename _Args, typename _Receiver>
+class deferred_state final
+    : public deferred_permit<deferred_state<_Signature, _Func, _Args, _Receiver>, deferred_placeholder_t<_Args>> {
+public:
+    template <typename _Recv>
+    deferred_state(_Func&& func, _Args&& args, _Recv&& receiver)
+        : func_{std::move(func)}, args_{std::move(args)}, receiver_{std::forward<_Recv>(receiver)} {
+    }
+
+    // only before start()
+    deferred_state(deferred_state&&) = default;
+    deferred_state(const deferred_state&) = delete;
+    deferred_state& operator=(const deferred_state&) = delete;
+
+    void start() noexcept {
+        if (this->acquire_permit(std::get<placeholder_index<_Args>{}>(args_))) {
+            run();
+        }
+    }
+
+    // the state of its own callback, see borrowed_handler
+    deferred_state* promise() noexcept {
+        return this;
+    }
+
+    template <typename... _Values>
+    void emplace_value(_Values&&... values) {
+        this->release_permit();
+        receiver_.set_value(std::forward<_Values>(values)...);
+    }
+
+private:
+    friend class deferred_permit<deferred_state, deferred_placeholder_t<_Args>>;
+
+    void run() noexcept {
+        constexpr std::size_t index = placeholder_index<_Args>{};
+        using callback_t = typename callback_type<_Signature, _Func, index>::type;
+        auto callback = make_callee_callback<callback_t>(this, std::is_void<_Signature>{});
+        try {
+            detail::apply(index_apply<std::tuple_size<_Args>{}>([&](auto... _Indexes) {
+                              return std::make_tuple(replace_placeholder(std::get<_Indexes>(std::move(args_)), callback)...);
+                          }),
+                          std::move(func_));
+        } catch (...) {
+            this->release_permit();
+            receiver_.set_error(std::current_exception());
+        }
+    }
+
+    _Func func_;
+    _Args args_;
+    _Receiver receiver_;
+};
+
+template <typename _Signature, typename _Func, typename _Args, typename _Receiver>
+borrowed_handler<deferred_state<_Signature, _Func, _Args, _Receiver>> make_handler(
+    deferred_state<_Signature, _Func, _Args, _Receiver>* state) noexcept {
+    return borrowed_handler<deferred_state<_Signature, _Func, _Args, _Receiver>>{state};
+}
+
+template <typename _Signature, typename _Func, typename _Args>
+struct deferred_result {
+    using callback_t = typename callback_type<_Signature, _Func, placeholder_index<_Args>{}>::type;
+    using type = callback_result_t<completion_signature_t<callback_t>>;
+};
+
+#if defined(ENABLE_CO_AWAIT)
+// the awaiter of a placeholder::deferred call, the operation state and the result live in the
+// awaiting coroutine's frame. the call starts in await_suspend, a callback firing before func
+// returns lets the coroutine continue without suspending.
+template <typename _Signature, typename _Func, typename _Args>
+class deferred_awaiter final {
+public:
+    using result_type = typename deferred_result<_Signature, _Func, _Args>::type;
+
+    // built in place by operator co_await, the receiver keeps this
+    deferred_awaiter(_Func&& func, _Args&& args) : state_{std::move(func), std::move(args), receiver{this}} {
+    }
+
+    deferred_awaiter(const deferred_awaiter&) = delete;
+    deferred_awaiter& operator=(const deferred_awaiter&) = delete;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        handle_ = handle;
+        state_.start();
+        // the second of start() returning and the callback firing goes on
+        return !done_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    result_type await_resume() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        return result_.take();
+    }
+
+private:
+    struct receiver final {
+        template <typename... _Values>
+        void set_value(_Values&&... values) noexcept {
+            try {
+                self->result_.emplace(std::forward<_Values>(values)...);
+            } catch (...) {
+                self->exception_ = std::current_exception();
+            }
+            self->complete();
+        }
+
+        void set_error(std::exception_ptr exception) noexcept {
+            self->exception_ = std::move(exception);
+            self->complete();
+        }
+
+        deferred_awaiter* self;
+    };
+
+    void complete() noexcept {
+        if (done_.exchange(true, std::memory_order_acq_rel)) {
+            handle_.resume();
+        }
+    }
+
+    deferred_state<_Signature, _Func, _Args, receiver> state_;
+    std::coroutine_handle<> handle_;
+    inline_result<result_type> result_;
+    std::exception_ptr exception_{nullptr};
+    std::atomic_bool done_{false};
+};
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace detail
+
+// a placeholder::deferred call, nothing runs until it is awaited or connected and started.
+// func and the arguments are moved in, the callback is bound to the operation state, so the
+// call allocates nothing. usable once, as rvalue.
+template <typename _Signature, typename _Func, typename... _Args>
+class deferred_operation {
+public:
+    using args_tuple = std::tuple<_Args...>;
+    // what co_await yields: void, the single callback argument or a std::tuple of them
+    using value_type = typename detail::deferred_result<_Signature, _Func, args_tuple>::type;
+
+    template <typename _Fn, typename... _Ts>
+    explicit deferred_operation(_Fn&& func, _Ts&&... args)
+        : func_{std::forward<_Fn>(func)}, args_{std::forward<_Ts>(args)...} {
+    }
+
+    // sender style, the receiver provides
+    //   void set_value(Values&&... values);   // the callback arguments, without a C callback's user data
+    //   void set_error(std::exception_ptr e); // func threw
+    // the returned operation state must not move once start() was called
+    template <typename _Receiver>
+    auto connect(_Receiver&& receiver) && {
+        return detail::deferred_state<_Signature, _Func, args_tuple, std::decay_t<_Receiver>>{
+            std::move(func_), std::move(args_), std::forward<_Receiver>(receiver)};
+    }
+
+#if defined(ENABLE_CO_AWAIT)
+    auto operator co_await() && {
+        return detail::deferred_awaiter<_Signature, _Func, args_tuple>{std::move(func_), std::move(args_)};
+    }
+#endif // defined(ENABLE_CO_AWAIT)
+
+private:
+    _Func func_;
+    args_tuple args_;
+};
+
+namespace detail {
+
+template <typename... _Args>
+struct is_deferred_call : std::false_type {};
+
+template <typename _Arg, typename... _Args>
+struct is_deferred_call<_Arg, _Args...>
+    : std::integral_constant<bool, std::is_same<std::decay_t<_Arg>, placeholder_deferred_t>{} ||
+                                       std::is_same<std::decay_t<_Arg>, placeholder_limited_t<placeholder_deferred_t>>{} ||
+                                       is_deferred_call<_Args...>{}> {};
+
+template <typename _Signature, typename _Alloc, typename _Func, typename... _Args>
+auto async_wrapper_call(std::true_type, const _Alloc&, _Func&& func, _Args&&... args) {
+    return deferred_operation<_Signature, std::decay_t<_Func>, std::decay_t<_Args>...>{std::forward<_Func>(func),
+                                                                                      std::forward<_Args>(args)...};
+}
+
+template <typename _Signature, typename _Alloc, typename _Func, typename... _Args>
+auto async_wrapper_call(std::false_type, const _Alloc& alloc, _Func&& func, _Args&&... args) {
+    using args_tuple = std::tuple<std::decay_t<_Args>...>;
+    constexpr std::size_t index = placeholder_index<args_tuple>{};
+    static_assert(index < sizeof...(_Args), "no placeholder in arguments");
+    using callback_t = typename callback_type<_Signature, _Func, index>::type;
+    auto completion =
+        make_completion<completion_signature_t<callback_t>>(alloc, std::get<index>(std::forward_as_tuple(args...)));
+    // moved out before the call, so a result written inline is not moved again on return
+    auto future = std::move(completion.second);
+#if defined(ENABLE_INSTRUMENTATION)
+    launch_call(completion.first, call_site_of(func));
+#endif // defined(ENABLE_INSTRUMENTATION)
+    auto callback = make_callee_callback<callback_t>(completion.first, std::is_void<_Signature>{});
+    {
+        const auto scope = make_inline_call_scope(future);
+        (void)scope;
+        start_call<decltype(future)>(
+            std::get<index>(std::forward_as_tuple(args...)), alloc, completion.first, std::forward<_Func>(func),
+            std::make_tuple(replace_placeholder(std::forward<_Args>(args), std::move(callback))...));
+    }
+    return future;
+}
+
+// _Signature is void unless the caller named the callback signature
+template <typename _Signature, typename _Alloc, typename _Func, typename... _Args>
+auto async_wrapper_impl(const _Alloc& alloc, _Func&& func, _Args&&... args) {
+    return async_wrapper_call<_Signature>(is_deferred_call<_Args...>{}, alloc, std::forward<_Func>(func),
+                                          std::forward<_Args>(args)...);
+}
+
+} // namespace detail
+
+// stateless allocator backed by the built-in recycling pool
+template <typename _Ty>
+class recycling_allocator {
+public:
+    using value_type = _Ty;
+    using stats_type = detail::recycling_pool::stats_type;
+
+    recycling_allocator() noexcept = default;
+
+    template <typename _Other>
+    recycling_allocator(const recycling_allocator<_Other>&) noexcept {
+    }
+
+    _Ty* allocate(std::size_t n) {
+        static_assert(alignof(_Ty) <= alignof(std::max_align_t), "over-aligned type");
+        return static_cast<_Ty*>(detail::recycling_pool::allocate(n * sizeof(_Ty)));
+    }
+
+    void deallocate(_Ty* p, std::size_t) noexcept {
+        detail::recycling_pool::deallocate(p);
+    }
+
+    static stats_type stats() noexcept {
+        return detail::recycling_pool::stats();
+    }
+};
+
+template <typename _Ty, typename _Other>
+bool operator==(const recycling_allocator<_Ty>&, const recycling_allocator<_Other>&) noexcept {
+    return true;
+}
+
+template <typename _Ty, typename _Other>
+bool operator!=(const recycling_allocator<_Ty>&, const recycling_allocator<_Other>&) noexcept {
+    return false;
+}
+
+#if defined(ENABLE_CO_AWAIT)
+namespace detail {
+
+// promise of a coroutine returning awaitable_future. the frame is shared by the running coroutine
+// and its future and destroyed by whichever lets go last, at final suspend or when the future is
+// dropped. frames come from the per-thread size classes of the recycling pool.
+template <typename _Ty>
+class coroutine_promise final : public awaitable_promise<_Ty>, public shared_state_base {
+public:
+    coroutine_promise() noexcept {
+        // one reference for the coroutine, one for the future
+        add_ref();
+    }
+
+    static void* operator new(std::size_t size) {
+        return recycling_pool::allocate(size);
+    }
+
+    static void operator delete(void* p) noexcept {
+        recycling_pool::deallocate(p);
+    }
+
+    awaitable_future<_Ty> get_return_object() noexcept {
+        return this->get_future(this);
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    auto final_suspend() noexcept {
+        struct awaiter final {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            // the awaiting coroutine takes over this thread without nesting a resume() per finished
+            // coroutine, so deep chains unwind in constant stack. the frame may be gone after release().
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<coroutine_promise> handle) noexcept {
+                auto& promise = handle.promise();
+                const auto next = promise.finish();
+                promise.release();
+                return next ? next : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {
+            }
+        };
+        return awaiter{};
+    }
+
+    void unhandled_exception() noexcept {
+        this->exception_ = std::current_exception();
+    }
+
+private:
+    void destroy() noexcept override {
+        std::coroutine_handle<coroutine_promise>::from_promise(*this).destroy();
+    }
+};
+
+} // namespace detail
+#endif // defined(ENABLE_CO_AWAIT)
+
+namespace detail {
+
+template <typename _Ty, bool _OnError, typename _Func, typename _Executor>
+class then_state;
+
+// runs posted work right away, then() without an executor
+struct inline_executor final {
+    template <typename _Func>
+    void post(_Func&& func) const {
+        func();
+    }
+};
+
+// what func returns when called with the result of a continuable_future<_Ty>, or with its exception
+template <typename _Func, typename _Ty, bool _OnError>
+struct continuation_call {
+    using type = decltype(std::declval<_Func&>()(std::declval<_Ty>()));
+};
+
+template <typename _Func>
+struct continuation_call<_Func, void, false> {
+    using type = decltype(std::declval<_Func&>()());
+};
+
+template <typename _Func, typename _Ty>
+struct continuation_call<_Func, _Ty, true> {
+    using type = decltype(std::declval<_Func&>()(std::declval<std::exception_ptr>()));
+};
+
+// a continuation returning a continuable_future completes with that future's result
+template <typename _Ty>
+struct unwrap_continuable {
+    using type = _Ty;
+};
+
+template <typename _Ty>
+struct unwrap_continuable<continuable_future<_Ty>> {
+    using type = _Ty;
+};
+
+inline void wait_ready(continuable_promise_base& promise);
+
+} // namespace detail
+
+// the result of a placeholder::continuable call. then() attaches what runs with the result, inline on
+// the thread completing the call or posted to an executor, so no thread blocks on a pending call.
+// an exception skips the continuations down the chain until on_error() or get() sees it.
+template <typename _Ty>
+class continuable_future {
+public:
+    continuable_future() noexcept = default;
+    continuable_future(const continuable_future&) = delete;
+    continuable_future& operator=(const continuable_future&) = delete;
+
+    continuable_future(continuable_future&& rhs) noexcept : promise_{rhs.promise_}, owner_{rhs.owner_} {
+        rhs.promise_ = nullptr;
+        rhs.owner_ = nullptr;
+    }
+
+    continuable_future& operator=(continuable_future&& rhs) noexcept {
+        if (std::addressof(rhs) != this) {
+            reset();
+            promise_ = rhs.promise_;
+            owner_ = rhs.owner_;
+            rhs.promise_ = nullptr;
+            rhs.owner_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~continuable_future() {
+        reset();
+    }
+
+    bool valid() const noexcept {
+        return promise_ != nullptr;
+    }
+
+    bool ready() const noexcept {
+        return promise_->ready();
+    }
+
+    // blocks the calling thread until the result is there
+    void wait() {
+        if (!ready()) {
+            detail::wait_ready(*promise_);
+        }
+    }
+
+    // waits, then returns the result or rethrows
+    _Ty get() {
+        wait();
+        return promise_->take();
+    }
+
+    // func(_Ty), or func() for void, runs on the thread completing this future, or right here if it
+    // already is. the returned future completes with what func returns, with the result of the
+    // continuable_future it returns, or with the exception it throws. this future is consumed.
+    template <typename _Func>
+    auto then(_Func&& func) && {
+        return chain<false>(detail::inline_executor{}, std::forward<_Func>(func));
+    }
+
+    // as above, but func is posted to executor, even if this future is ready already.
+    // executor is referenced when passed as lvalue, see placeholder::awaitable_on for what it provides.
+    template <typename _Executor, typename _Func>
+    auto then(_Executor&& executor, _Func&& func) && {
+        return chain<false>(std::forward<_Executor>(executor), std::forward<_Func>(func));
+    }
+
+    // func(std::exception_ptr) recovers a failed future with a _Ty, or rethrows. a value passes through.
+    template <typename _Func>
+    continuable_future on_error(_Func&& func) && {
+        return chain<true>(detail::inline_executor{}, std::forward<_Func>(func));
+    }
+
+private:
+    template <typename>
+    friend class detail::continuable_promise;
+
+    template <typename, bool, typename, typename>
+    friend class detail::then_state;
+
+    continuable_future(detail::continuable_promise<_Ty>* promise, detail::shared_state_base* owner) noexcept
+        : promise_{promise}, owner_{owner} {
+    }
+
+    // the continuation takes over the reference of this future
+    template <bool _OnError, typename _Executor, typename _Func>
+    auto chain(_Executor&& executor, _Func&& func) {
+        using state_t = detail::then_state<_Ty, _OnError, std::decay_t<_Func>, _Executor>;
+        auto state = new state_t{promise_, owner_, std::forward<_Executor>(executor), std::forward<_Func>(func)};
+        promise_ = nullptr;
+        owner_ = nullptr;
+        return state->start();
+    }
+
+    void reset() noexcept {
+        if (owner_) {
+            owner_->release();
+        }
+        promise_ = nullptr;
+        owner_ = nullptr;
+    }
+
+    detail::continuable_promise<_Ty>* promise_{nullptr};
+    detail::shared_state_base* owner_{nullptr};
+};
+
+namespace detail {
+
+inline continuable_future<void> continuable_promise<void>::get_future(shared_state_base* owner) noexcept {
+    return continuable_future<void>{this, owner};
+}
+
+inline void wait_ready(continuable_promise_base& promise) {
+    struct waiter final : continuable_promise_base::continuation {
+        waiter() noexcept : continuation{&wake} {
+        }
+
+        static void wake(continuation* node) {
+            auto self = static_cast<waiter*>(node);
+            // the waiter may return once it sees 2, so that is the last thing touched
+            self->woken.store(1, std::memory_order_release);
+            atomic_notify_one(self->woken);
+            self->woken.store(2, std::memory_order_release);
+        }
+
+        std::atomic<std::uint32_t> woken{0};
+    };
+
+    waiter node;
+    if (!promise.attach(&node)) {
+        return;
+    }
+    for (;;) {
+        const auto woken = node.woken.load(std::memory_order_acquire);
+        if (woken == 2) {
+            return;
+        }
+        if (woken == 0) {
+            atomic_wait(node.woken, 0);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+template <typename _Ty>
+void forward_result(continuable_promise<_Ty>& from, continuable_promise<_Ty>& to) {
+    if (from.failed()) {
+        to.set_exception(from.exception());
+    } else {
+        to.emplace_value(from.take());
+    }
+}
+
+inline void forward_result(continuable_promise<void>& from, continuable_promise<void>& to) {
+    if (from.failed()) {
+        to.set_exception(from.exception());
+    } else {
+        to.set_value();
+    }
+}
+
+// one then() or on_error(), holding func and the promise of the future it returned. the source's
+// reference is dropped once func ran, the state itself goes with the last of its future and its run.
+// allocated from the per-thread pool like coroutine frames.
+template <typename _Ty, bool _OnError, typename _Func, typename _Executor>
+class then_state final : public shared_state_base, private continuable_promise_base::continuation {
+public:
+    using result_type = typename continuation_call<_Func, _Ty, _OnError>::type;
+    using value_type = typename unwrap_continuable<std::decay_t<result_type>>::type;
+
+    static_assert(!_OnError || std::is_same<value_type, _Ty>{}, "on_error must recover with the same type");
+
+    static void* operator new(std::size_t size) {
+        return recycling_pool::allocate(size);
+    }
+
+    static void operator delete(void* p) noexcept {
+        recycling_pool::deallocate(p);
+    }
+
+    template <typename _Exec, typename _Fn>
+    then_state(continuable_promise<_Ty>* source, shared_state_base* source_owner, _Exec&& executor, _Fn&& func)
+        : continuation{&on_ready},
+          source_{source},
+          source_owner_{source_owner},
+          executor_{std::forward<_Exec>(executor)},
+          func_{std::forward<_Fn>(func)} {
+        // one reference for the run, one for the future
+        add_ref();
+    }
+
+    continuable_future<value_type> start() noexcept {
+        auto future = promise_.get_future(this);
+        if (!source_->attach(this)) {
+            on_ready(this);
+        }
+        return future;
+    }
+
+private:
+    struct inner_continuation final : continuable_promise_base::continuation {
+        then_state* self;
+    };
+
+    using category = std::integral_constant<int, std::is_void<result_type>{}                               ? 0
+                                                 : std::is_same<value_type, std::decay_t<result_type>>{} ? 1
+                                                                                                          : 2>;
+
+    static void on_ready(continuation* node) {
+        auto self = static_cast<then_state*>(node);
+        self->executor_.post([self]() { self->invoke(); });
+    }
+
+    void invoke() noexcept {
+        if (pass_through(std::integral_constant<bool, _OnError>{})) {
+            finish();
+            return;
+        }
+        try {
+            settle(category{});
+        } catch (...) {
+            promise_.set_exception(std::current_exception());
+            finish();
+        }
+    }
+
+    // true if func is skipped and the source's result went on as it is
+    bool pass_through(std::false_type) noexcept {
+        if (!source_->failed()) {
+            return false;
+        }
+        promise_.set_exception(source_->exception());
+        return true;
+    }
+
+    bool pass_through(std::true_type) {
+        if (source_->failed()) {
+            return false;
+        }
+        forward_result(*source_, promise_);
+        return true;
+    }
+
+    result_type call(std::false_type, std::false_type) {
+        return func_(source_->take());
+    }
+
+    result_type call(std::false_type, std::true_type) {
+        return func_();
+    }
+
+    template <typename _Void>
+    result_type call(std::true_type, _Void) {
+        return func_(source_->exception());
+    }
+
+    result_type call() {
+        return call(std::integral_constant<bool, _OnError>{}, std::is_void<_Ty>{});
+    }
+
+    void settle(std::integral_constant<int, 0>) {
+        call();
+        promise_.set_value();
+        finish();
+    }
+
+    void settle(std::integral_constant<int, 1>) {
+        promise_.emplace_value(call());
+        finish();
+    }
+
+    // func returned a continuable_future, its result completes ours
+    void settle(std::integral_constant<int, 2>) {
+        inner_ = call();
+        source_owner_->release();
+        source_owner_ = nullptr;
+        if (!inner_.valid()) {
+            throw std::runtime_error{"no state"};
+        }
+        inner_continuation_.run = &on_inner_ready;
+        inner_continuation_.self = this;
+        if (!inner_.promise_->attach(&inner_continuation_)) {
+            on_inner_ready(&inner_continuation_);
+        }
+    }
+
+    static void on_inner_ready(continuation* node) {
+        auto self = static_cast<inner_continuation*>(node)->self;
+        forward_result(*self->inner_.promise_, self->promise_);
+        self->inner_ = {};
+        self->release();
+    }
+
+    void finish() noexcept {
+        if (source_owner_) {
+            source_owner_->release();
+        }
+        release();
+    }
+
+    void destroy() noexcept override {
+        delete this;
+    }
+
+    continuable_promise<_Ty>* source_;
+    shared_state_base* source_owner_;
+    _Executor executor_;
+    _Func func_;
+    continuable_promise<value_type> promise_;
+    continuable_future<value_type> inner_;
+    inner_continuation inner_continuation_;
+};
+
+} // namespace detail
+
+template <typename _Func, typename... _Args>
+auto async_wrapper(_Func&& func, _Args&&... args) {
+    return detail::async_wrapper_impl<void>(std::allocator<void>{}, std::forward<_Func>(func),
+                                            std::forward<_Args>(args)...);
+}
+
+// the completion state is allocated with alloc, e.g. recycling_allocator<void>
+template <typename _Alloc, typename _Func, typename... _Args>
+auto async_wrapper(std::allocator_arg_t, _Alloc&& alloc, _Func&& func, _Args&&... args) {
+    return detail::async_wrapper_impl<void>(alloc, std::forward<_Func>(func), std::forward<_Args>(args)...);
+}
+
+// for callees taking a deduced handler type, e.g. template <class Handler> void read(int, Handler&&),
+// _Signature names how the handler is called. the callee gets the handler itself instead of a
+// std::function, so there is no indirect call and nothing to allocate for the callback.
+template <typename _Signature, typename _Func, typename... _Args>
+auto async_wrapper(_Func&& func, _Args&&... args) {
+    return detail::async_wrapper_impl<_Signature>(std::allocator<void>{}, std::forward<_Func>(func),
+                                                  std::forward<_Args>(args)...);
+}
+
+template <typename _Signature, typename _Alloc, typename _Func, typename... _Args>
+auto async_wrapper(std::allocator_arg_t, _Alloc&& alloc, _Func&& func, _Args&&... args) {
+    return detail::async_wrapper_impl<_Signature>(alloc, std::forward<_Func>(func), std::forward<_Args>(args)...);
+}
+
+template <typename _Ty>
+struct when_any_result {
+    std::size_t index;
+    _Ty value;
+};
+
+template <>
+struct when_any_result<void> {
+    std::size_t index;
+};
+
+namespace detail {
+
+// void results become std::tuple<>, like a callback without arguments
+template <typename _Ty>
+struct when_result {
+    using type = _Ty;
+};
+
+template <>
+struct when_result<void> {
+    using type = std::tuple<>;
+};
+
+template <typename _Ty>
+using when_result_t = typename when_result<_Ty>::type;
+
+template <typename _Get>
+std::tuple<> take_result(_Get&& get, std::true_type) {
+    get();
+    return {};
+}
+
+template <typename _Get>
+auto take_result(_Get&& get, std::false_type) {
+    return get();
+}
+
+template <typename _Ty>
+when_result_t<_Ty> take_result(std::future<_Ty>& future) {
+    return take_result([&]() { return future.get(); }, std::is_void<_Ty>{});
+}
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Ty>
+when_result_t<_Ty> take_result(awaitable_future<_Ty>& future);
+#endif // defined(ENABLE_CO_AWAIT)
+
+template <typename _Ty>
+when_any_result<_Ty> make_when_any_result(std::size_t index, _Ty&& value) {
+    return {index, std::move(value)};
+}
+
+inline when_any_result<void> make_when_any_result(std::size_t index, std::tuple<>) {
+    return {index};
+}
+
+template <typename... _Futures, typename _Func>
+void for_each_future(std::tuple<_Futures...>& futures, _Func&& func) {
+    index_apply<sizeof...(_Futures)>([&](auto... _Indexes) {
+        int expand[]{0, (func(std::get<_Indexes>(futures)), 0)...};
+        (void)expand;
+    });
+}
+
+template <typename _Future, typename _Func>
+void for_each_future(std::vector<_Future>& futures, _Func&& func) {
+    for (auto& future : futures) {
+        func(future);
+    }
+}
+
+template <typename... _Futures>
+constexpr std::size_t future_count(const std::tuple<_Futures...>&) noexcept {
+    return sizeof...(_Futures);
+}
+
+template <typename _Future>
+std::size_t future_count(const std::vector<_Future>& futures) noexcept {
+    return futures.size();
+}
+
+template <typename _Ty>
+auto take_results(std::vector<_Ty>& futures, std::true_type) {
+    for (auto& future : futures) {
+        take_result(future);
+    }
+}
+
+template <typename _Ty>
+auto take_results(std::vector<_Ty>& futures, std::false_type) {
+    std::vector<decltype(take_result(futures.front()))> results;
+    results.reserve(futures.size());
+    for (auto& future : futures) {
+        results.push_back(take_result(future));
+    }
+    return results;
+}
+
+} // namespace detail
+
+// std::future has no completion hook, so when_all waits on the futures in turn, waking at most once
+// per future still pending and never for one already done. prefer the awaitable_future overloads.
+
+template <typename... _Ty>
+std::tuple<detail::when_result_t<_Ty>...> when_all(std::future<_Ty>&&... futures) {
+    return std::tuple<detail::when_result_t<_Ty>...>{detail::take_result(futures)...};
+}
+
+template <typename _Ty>
+auto when_all(std::vector<std::future<_Ty>> futures) {
+    return detail::take_results(futures, std::is_void<_Ty>{});
+}
+
+// sleeps until a wrapped call completes, then looks for a ready future. futures not returned by
+// async_wrapper are looked at again every millisecond.
+template <typename _Ty>
+when_any_result<_Ty> when_any(std::vector<std::future<_Ty>> futures) {
+    if (futures.empty()) {
+        throw std::invalid_argument{"when_any of no futures"};
+    }
+    constexpr std::chrono::milliseconds fallback{1};
+    auto winner = futures.size();
+    const auto ready = [&]() {
+        for (std::size_t i = 0; i < futures.size(); ++i) {
+            if (futures[i].wait_for(std::chrono::seconds{0}) == std::future_status::ready) {
+                winner = i;
+                return true;
+            }
+        }
+        return false;
+    };
+    while (!ready()) {
+        detail::future_signal::instance().wait_for(ready, fallback);
+    }
+    return detail::make_when_any_result(winner, detail::take_result(futures[winner]));
+}
+
+template <typename _Ty, typename... _Rest>
+when_any_result<_Ty> when_any(std::future<_Ty>&& first, std::future<_Rest>&&... rest) {
+    static_assert(detail::all_same<_Ty, _Rest...>{}, "when_any needs futures of the same type");
+    std::vector<std::future<_Ty>> futures;
+    futures.reserve(1 + sizeof...(_Rest));
+    int expand[]{(futures.push_back(std::move(first)), 0), (futures.push_back(std::move(rest)), 0)...};
+    (void)expand;
+    return when_any(std::move(futures));
+}
+
+#if defined(ENABLE_CO_AWAIT)
 namespace detail {
 
-struct placeholder_std_future_t final {};
+struct awaitable_access final {
+    template <typename _Ty>
+    static bool ready(const awaitable_future<_Ty>& future) noexcept {
+        return future.await_ready();
+    }
 
-struct placeholder_awaitable_t final {};
+    template <typename _Ty>
+    static bool suspend(awaitable_future<_Ty>& future, awaitable_promise_base::continuation* node) noexcept {
+        return !future.inline_.has_value() && future.promise_->suspend(node);
+    }
+
+    template <typename _Ty>
+    static bool unsuspend(awaitable_future<_Ty>& future, awaitable_promise_base::continuation* node) noexcept {
+        return !future.inline_.has_value() && future.promise_->unsuspend(node);
+    }
+
+    template <typename _Ty>
+    static when_result_t<_Ty> take(awaitable_future<_Ty>& future) {
+        return take_result([&]() { return future.await_resume(); }, std::is_void<_Ty>{});
+    }
+};
 
 template <typename _Ty>
-using is_std_future_placeholder = std::is_same<std::decay_t<_Ty>, placeholder_std_future_t>;
+when_result_t<_Ty> take_result(awaitable_future<_Ty>& future) {
+    return awaitable_access::take(future);
+}
+
+// counts the completions of a set of futures and wakes the waiter once, when the last one arrives.
+// it lives in the awaiting coroutine frame or on the blocked thread's stack.
+class completion_group final : private awaitable_promise_base::continuation {
+public:
+    explicit completion_group(std::size_t count) noexcept : continuation{&arrive}, pending_{count + 1} {
+    }
+
+    // only before anything was added
+    completion_group(completion_group&& rhs) noexcept
+        : continuation{&arrive}, pending_{rhs.pending_.load(std::memory_order_relaxed)} {
+    }
+
+    void waiter(std::coroutine_handle<> handle) noexcept {
+        waiter_ = handle;
+    }
+
+    template <typename _Ty>
+    void add(awaitable_future<_Ty>& future) noexcept {
+        if (!awaitable_access::suspend(future, this)) {
+            pending_.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    // the waiter's own arrival after adding everything, true if all completed meanwhile
+    bool seal() noexcept {
+        return pending_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    // blocks the thread until the last arrival
+    void wait() noexcept {
+        for (;;) {
+            const auto woken = woken_.load(std::memory_order_acquire);
+            if (woken == woken_done) {
+                return;
+            }
+            if (woken == 0) {
+                atomic_wait(woken_, 0);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    static void arrive(continuation* node) {
+        auto self = static_cast<completion_group*>(node);
+        if (self->pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        if (self->waiter_) {
+            self->waiter_.resume();
+            return;
+        }
+        // the waiter may return once it sees woken_done, so that is the last thing touched
+        self->woken_.store(1, std::memory_order_release);
+        atomic_notify_one(self->woken_);
+        self->woken_.store(woken_done, std::memory_order_release);
+    }
+
+    static constexpr std::uint32_t woken_done{2};
+
+    std::atomic<std::size_t> pending_;
+    std::coroutine_handle<> waiter_;
+    std::atomic<std::uint32_t> woken_{0};
+};
 
 template <typename _Ty>
-using is_awaitable_placeholder = std::is_same<std::decay_t<_Ty>, placeholder_awaitable_t>;
+void wait_future(awaitable_future<_Ty>& future) {
+    completion_group group{1};
+    group.add(future);
+    if (!group.seal()) {
+        group.wait();
+    }
+}
+
+template <typename... _Ty>
+auto take_results(std::tuple<awaitable_future<_Ty>...>& futures) {
+    return index_apply<sizeof...(_Ty)>([&](auto... _Indexes) {
+        return std::tuple<when_result_t<_Ty>...>{awaitable_access::take(std::get<_Indexes>(futures))...};
+    });
+}
 
-#if defined(ENABLE_CO_AWAIT)
 template <typename _Ty>
-class awaitable_promise;
-#endif // defined(ENABLE_CO_AWAIT)
+auto take_results(std::vector<awaitable_future<_Ty>>& futures) {
+    return take_results(futures, std::is_void<_Ty>{});
+}
 
-} // namespace detail
+// must not be moved once awaited
+template <typename _Futures>
+class when_all_awaitable final {
+public:
+    explicit when_all_awaitable(_Futures&& futures)
+        : futures_{std::move(futures)}, group_{future_count(futures_)} {
+    }
 
-#if defined(ENABLE_CO_AWAIT)
+    when_all_awaitable(when_all_awaitable&&) = default;
+
+    // for coroutine
+    bool await_ready() noexcept {
+        bool ready{true};
+        for_each_future(futures_, [&](auto& future) { ready = ready && awaitable_access::ready(future); });
+        return ready;
+    }
+
+    // for coroutine
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        group_.waiter(handle);
+        for_each_future(futures_, [this](auto& future) { group_.add(future); });
+        return !group_.seal();
+    }
+
+    // for coroutine
+    auto await_resume() {
+        return take_results(futures_);
+    }
+
+    // blocks the calling thread, which is woken once when everything completed
+    auto get() {
+        if (!await_ready()) {
+            for_each_future(futures_, [this](auto& future) { group_.add(future); });
+            if (!group_.seal()) {
+                group_.wait();
+            }
+        }
+        return take_results(futures_);
+    }
+
+private:
+    _Futures futures_;
+    completion_group group_;
+};
+
+// shared by when_any_awaitable and one registration per future. taking the winner takes back the
+// losers' registrations, one completing meanwhile keeps it alive until its arrival.
 template <typename _Ty>
-class awaitable_future {
+class when_any_state final {
 public:
-    using promise_type = detail::awaitable_promise<_Ty>;
+    explicit when_any_state(std::vector<awaitable_future<_Ty>>&& futures)
+        : futures_{std::move(futures)},
+          nodes_{new node[futures_.size()]},
+          refs_{futures_.size() + 1} {
+        for (std::size_t i = 0; i < futures_.size(); ++i) {
+            nodes_[i].resume = &arrive;
+            nodes_[i].owner = this;
+            nodes_[i].index = i;
+        }
+    }
 
-    awaitable_future() noexcept = default;
-    awaitable_future(const awaitable_future&) = delete;
-    awaitable_future& operator=(const awaitable_future&) = delete;
+    // false if a future completed during registration, the waiter then goes on without waiting
+    bool start(std::coroutine_handle<> waiter) noexcept {
+        waiter_ = waiter;
+        for (std::size_t i = 0; i < futures_.size(); ++i) {
+            if (!awaitable_access::suspend(futures_[i], &nodes_[i])) {
+                arrive(&nodes_[i]);
+            }
+        }
+        return gate_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
 
-    awaitable_future(awaitable_future&& rhs) noexcept {
-        if (std::addressof(rhs) != this) {
-            promise_ = rhs.promise_;
-            rhs.promise_ = nullptr;
+    void wait() noexcept {
+        while (!woken_.load(std::memory_order_acquire)) {
+            atomic_wait(woken_, 0);
         }
     }
 
-    awaitable_future& operator=(awaitable_future&& rhs) noexcept {
-        if (std::addressof(rhs) != this) {
-            promise_ = rhs.promise_;
-            rhs.promise_ = nullptr;
+    when_any_result<_Ty> take() {
+        const auto index = winner_.load(std::memory_order_acquire);
+        // a loser that never completes would otherwise keep the state and every future
+        for (std::size_t i = 0; i < futures_.size(); ++i) {
+            if (i != index && awaitable_access::unsuspend(futures_[i], &nodes_[i])) {
+                release();
+            }
+        }
+        return make_when_any_result(index, awaitable_access::take(futures_[index]));
+    }
+
+    void release() noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+private:
+    struct node final : awaitable_promise_base::continuation {
+        when_any_state* owner;
+        std::size_t index;
+    };
+
+    static void arrive(awaitable_promise_base::continuation* continuation) {
+        auto self = static_cast<node*>(continuation);
+        auto owner = self->owner;
+        auto none = no_winner;
+        if (owner->winner_.compare_exchange_strong(none, self->index, std::memory_order_acq_rel)) {
+            // the winner and the registering waiter meet at the gate, the second one wakes
+            if (owner->gate_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                owner->wake();
+            }
+        }
+        owner->release();
+    }
+
+    void wake() noexcept {
+        if (waiter_) {
+            waiter_.resume();
+        } else {
+            woken_.store(1, std::memory_order_release);
+            atomic_notify_one(woken_);
+        }
+    }
+
+    static constexpr std::size_t no_winner{static_cast<std::size_t>(-1)};
+
+    std::vector<awaitable_future<_Ty>> futures_;
+    std::unique_ptr<node[]> nodes_;
+    std::atomic<std::size_t> refs_;
+    std::atomic<std::size_t> winner_{no_winner};
+    std::atomic<std::uint32_t> gate_{2};
+    std::atomic<std::uint32_t> woken_{0};
+    std::coroutine_handle<> waiter_;
+};
+
+template <typename _Ty>
+class when_any_awaitable final {
+public:
+    explicit when_any_awaitable(std::vector<awaitable_future<_Ty>>&& futures)
+        : state_{new when_any_state<_Ty>{std::move(futures)}} {
+    }
+
+    when_any_awaitable(const when_any_awaitable&) = delete;
+    when_any_awaitable& operator=(const when_any_awaitable&) = delete;
+
+    when_any_awaitable(when_any_awaitable&& rhs) noexcept : state_{rhs.state_} {
+        rhs.state_ = nullptr;
+    }
+
+    ~when_any_awaitable() {
+        if (state_) {
+            state_->release();
         }
-        return *this;
     }
 
     // for coroutine
     bool await_ready() const noexcept {
-        return promise_->ready();
+        return false;
     }
 
     // for coroutine
-    void await_suspend(std::experimental::coroutine_handle<> handle) noexcept {
-        promise_->suspend(std::move(handle));
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        return state_->start(handle);
     }
 
     // for coroutine
-    _Ty await_resume() noexcept {
-        return promise_->get();
+    when_any_result<_Ty> await_resume() {
+        return state_->take();
     }
 
-private:
-    template <typename>
-    friend class detail::awaitable_promise;
-
-    explicit awaitable_future(detail::awaitable_promise<_Ty>* promise) noexcept : promise_{promise} {
+    // blocks the calling thread until the first future completes
+    when_any_result<_Ty> get() {
+        if (state_->start(nullptr)) {
+            state_->wait();
+        }
+        return state_->take();
     }
 
-    detail::awaitable_promise<_Ty>* promise_{nullptr};
+private:
+    when_any_state<_Ty>* state_;
 };
 
+} // namespace detail
+
+// co_await when_all(...) resumes once with a std::tuple/std::vector of the results, get() blocks instead
+template <typename... _Ty>
+auto when_all(awaitable_future<_Ty>&&... futures) {
+    using futures_t = std::tuple<awaitable_future<_Ty>...>;
+    return detail::when_all_awaitable<futures_t>{futures_t{std::move(futures)...}};
+}
+
 template <typename _Ty>
-using awaitable_t = awaitable_future<_Ty>;
+auto when_all(std::vector<awaitable_future<_Ty>> futures) {
+    return detail::when_all_awaitable<std::vector<awaitable_future<_Ty>>>{std::move(futures)};
+}
 
-using awaitable = awaitable_t<void>;
-#endif // defined(ENABLE_CO_AWAIT)
+// co_await when_any(...) resumes once with the index and the result of the first completed future
+template <typename _Ty>
+auto when_any(std::vector<awaitable_future<_Ty>> futures) {
+    if (futures.empty()) {
+        throw std::invalid_argument{"when_any of no futures"};
+    }
+    return detail::when_any_awaitable<_Ty>{std::move(futures)};
+}
 
-namespace placeholder {
+template <typename _Ty, typename... _Rest>
+auto when_any(awaitable_future<_Ty>&& first, awaitable_future<_Rest>&&... rest) {
+    static_assert(detail::all_same<_Ty, _Rest...>{}, "when_any needs futures of the same type");
+    std::vector<awaitable_future<_Ty>> futures;
+    futures.reserve(1 + sizeof...(_Rest));
+    int expand[]{(futures.push_back(std::move(first)), 0), (futures.push_back(std::move(rest)), 0)...};
+    (void)expand;
+    return when_any(std::move(futures));
+}
+#endif // defined(ENABLE_CO_AWAIT)
 
-constexpr detail::placeholder_std_future_t std_future{};
-constexpr detail::placeholder_awaitable_t awaitable{};
+// ranges of futures given as iterators are moved from
+template <typename _Iter, typename = typename std::iterator_traits<_Iter>::iterator_category>
+auto when_all(_Iter first, _Iter last) {
+    using future_t = typename std::iterator_traits<_Iter>::value_type;
+    return when_all(std::vector<future_t>(std::make_move_iterator(first), std::make_move_iterator(last)));
+}
 
-} // namespace placeholder
+template <typename _Iter, typename = typename std::iterator_traits<_Iter>::iterator_category>
+auto when_any(_Iter first, _Iter last) {
+    using future_t = typename std::iterator_traits<_Iter>::value_type;
+    return when_any(std::vector<future_t>(std::make_move_iterator(first), std::make_move_iterator(last)));
+}
 
 namespace detail {
 
-template <typename _Ty, typename _Tuple>
-struct tuple_has_type;
-
+// header and completion slots of a bulk call in one cache line aligned block, slot i belongs to
+// the i-th call. the future and every copy of a callback hold a reference.
 template <typename _Ty>
-struct tuple_has_type<_Ty, std::tuple<>> : std::false_type {};
+class bulk_state final {
+public:
+    using value_type = when_result_t<_Ty>;
 
-template <typename _Ty, typename _Head, typename... _Args>
-struct tuple_has_type<_Ty, std::tuple<_Head, _Args...>> : tuple_has_type<_Ty, std::tuple<_Args...>> {};
+    static constexpr std::size_t cache_line{64};
 
-template <typename _Ty, typename... _Args>
-struct tuple_has_type<_Ty, std::tuple<_Ty, _Args...>> : std::true_type {};
+    // one cache line per call, so callbacks completing on different threads do not share lines
+    class alignas(cache_line) slot final {
+    public:
+        explicit slot(bulk_state* owner) noexcept : owner_{owner} {
+        }
 
-template <typename _Tuple>
-using has_std_future = tuple_has_type<placeholder_std_future_t, _Tuple>;
+        slot(const slot&) = delete;
+        slot& operator=(const slot&) = delete;
 
-template <typename _Tuple>
-using has_awaitable = tuple_has_type<placeholder_awaitable_t, _Tuple>;
+        ~slot() {
+            if (status_.load(std::memory_order_relaxed) == has_value) {
+                value().~value_type();
+            }
+        }
 
-template <typename _Ty, typename _Tuple>
-struct type_index;
+        // the callback protocol of completion_handler, each copy holds a reference to the bulk state
 
-template <typename _Ty, typename... _Args>
-struct type_index<_Ty, std::tuple<_Ty, _Args...>> : public std::integral_constant<std::size_t, 0> {};
+        slot* promise() noexcept {
+            return this;
+        }
 
-template <typename _Ty, typename _Head, typename... _Args>
-struct type_index<_Ty, std::tuple<_Head, _Args...>>
-    : public std::integral_constant<std::size_t, 1 + type_index<_Ty, std::tuple<_Args...>>{}> {};
+        void add_callback() noexcept {
+            owner_->add_ref();
+            callbacks_.copy();
+        }
 
-template <typename _Tuple>
-using std_future_index = type_index<placeholder_std_future_t, _Tuple>;
+        bool claim_callback() noexcept {
+            return callbacks_.fire();
+        }
 
-template <typename _Tuple>
-using awaitable_index = type_index<placeholder_awaitable_t, _Tuple>;
+        void drop_callback() noexcept {
+            if (callbacks_.drop()) {
+                set_exception(broken_promise());
+            }
+            owner_->release();
+        }
 
-template <typename _Ty>
-struct function_args;
+        template <typename... _Args>
+        void emplace_value(_Args&&... args) noexcept {
+            try {
+                ::new (static_cast<void*>(&storage_)) value_type(std::forward<_Args>(args)...);
+            } catch (...) {
+                set_exception(std::current_exception());
+                return;
+            }
+            status_.store(has_value, std::memory_order_release);
+            owner_->arrive();
+        }
 
-template <typename _Ret, typename... _Args>
-struct function_args<_Ret(_Args...)> {
-    using type = _Ret(_Args...);
-    using function_type = std::function<type>;
-    using return_type = _Ret;
-    static constexpr std::size_t arity{sizeof...(_Args)};
+        void set_exception(std::exception_ptr exception) noexcept {
+            exception_ = std::move(exception);
+            status_.store(has_exception, std::memory_order_release);
+            owner_->arrive();
+        }
 
-    using args_tuple = std::tuple<std::decay_t<_Args>...>;
+        bool ready() const noexcept {
+            return status_.load(std::memory_order_acquire) != empty;
+        }
 
-    template <std::size_t _Index>
-    struct arg {
-        using type = std::decay_t<typename std::tuple_element<_Index, std::tuple<_Args...>>::type>;
+        value_type take() {
+            const auto status = status_.load(std::memory_order_acquire);
+            if (status == has_exception) {
+                std::rethrow_exception(exception_);
+            }
+            if (status != has_value) {
+                throw std::runtime_error{"no value"};
+            }
+            return std::move(value());
+        }
+
+    private:
+        value_type& value() noexcept {
+            return *reinterpret_cast<value_type*>(&storage_);
+        }
+
+        static constexpr std::uint32_t empty{0};
+        static constexpr std::uint32_t has_value{1};
+        static constexpr std::uint32_t has_exception{2};
+
+        bulk_state* owner_;
+        callback_tally callbacks_;
+        std::atomic<std::uint32_t> status_{empty};
+        std::exception_ptr exception_;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage_;
     };
 
-    template <std::size_t _Index>
-    using arg_t = typename arg<_Index>::type;
-};
+    static bulk_state* create(std::size_t count) {
+        auto raw = ::operator new(slots_offset() + count * sizeof(slot) + cache_line - 1);
+        const auto aligned = (reinterpret_cast<std::uintptr_t>(raw) + cache_line - 1) & ~(cache_line - 1);
+        auto state = ::new (reinterpret_cast<void*>(aligned)) bulk_state{raw, count};
+        for (std::size_t i = 0; i < count; ++i) {
+            ::new (static_cast<void*>(state->slots() + i)) slot{state};
+        }
+        return state;
+    }
 
-template <typename _Ret, typename _Arg>
-struct function_args<_Ret(_Arg)> {
-    using type = _Ret(_Arg);
-    using function_type = std::function<type>;
-    using return_type = _Ret;
-    static constexpr std::size_t arity{1};
+    std::size_t size() const noexcept {
+        return count_;
+    }
 
-    using args_tuple = std::decay_t<_Arg>;
+    slot& operator[](std::size_t index) noexcept {
+        return slots()[index];
+    }
 
-    template <std::size_t _Index>
-    struct arg {
-        using type = std::decay_t<_Arg>;
-    };
+    void add_ref() noexcept {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
 
-    template <std::size_t _Index>
-    using arg_t = typename arg<_Index>::type;
-};
+    void release() noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+    }
 
-template <typename _Ret>
-struct function_args<_Ret()> {
-    using type = _Ret();
-    using function_type = std::function<type>;
-    using return_type = _Ret;
-    static constexpr std::size_t arity{0};
+    // the methods below are for the single consumer holding the future
 
-    using args_tuple = void;
+    bool ready() const noexcept {
+        return sealed_ ? woken_.load(std::memory_order_acquire) != 0 : pending_.load(std::memory_order_acquire) == 1;
+    }
 
-    template <std::size_t _Index>
-    struct arg {
-        using type = void;
-    };
+#if defined(ENABLE_CO_AWAIT)
+    void waiter(std::coroutine_handle<> handle) noexcept {
+        waiter_ = handle;
+    }
+#endif // defined(ENABLE_CO_AWAIT)
 
-    template <std::size_t _Index>
-    using arg_t = typename arg<_Index>::type;
+    // the consumer's own arrival, true if every call completed already
+    bool seal() noexcept {
+        sealed_ = true;
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return false;
+        }
+        woken_.store(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void wait() noexcept {
+        if (!sealed_ && seal()) {
+            return;
+        }
+        while (!woken_.load(std::memory_order_acquire)) {
+            atomic_wait(woken_, 0);
+        }
+    }
+
+private:
+    bulk_state(void* raw, std::size_t count) noexcept : raw_{raw}, count_{count}, refs_{count + 1}, pending_{count + 1} {
+    }
+
+    static constexpr std::size_t slots_offset() noexcept {
+        return (sizeof(bulk_state) + cache_line - 1) & ~(cache_line - 1);
+    }
+
+    slot* slots() noexcept {
+        return reinterpret_cast<slot*>(reinterpret_cast<char*>(this) + slots_offset());
+    }
+
+    void arrive() noexcept {
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            wake();
+        }
+    }
+
+    // woken_ is set even when a coroutine is resumed, so a later wait() returns at once
+    void wake() noexcept {
+        woken_.store(1, std::memory_order_release);
+#if defined(ENABLE_CO_AWAIT)
+        if (waiter_) {
+            waiter_.resume();
+            return;
+        }
+#endif // defined(ENABLE_CO_AWAIT)
+        atomic_notify_one(woken_);
+    }
+
+    void destroy() noexcept {
+        for (std::size_t i = 0; i < count_; ++i) {
+            slots()[i].~slot();
+        }
+        auto raw = raw_;
+        this->~bulk_state();
+        ::operator delete(raw);
+    }
+
+    void* raw_;
+    std::size_t count_;
+    std::atomic<std::size_t> refs_;
+    // one per call plus one for the consumer, see seal()
+    std::atomic<std::size_t> pending_;
+    std::atomic<std::uint32_t> woken_{0};
+    bool sealed_{false};
+#if defined(ENABLE_CO_AWAIT)
+    std::coroutine_handle<> waiter_;
+#endif // defined(ENABLE_CO_AWAIT)
 };
 
-template <typename _Ret, typename... _Args>
-struct function_args<_Ret (*)(_Args...)> : function_args<_Ret(_Args...)> {};
+template <typename _Ty>
+struct is_std_function : std::false_type {};
 
-template <typename _Ret, typename... _Args>
-struct function_args<std::function<_Ret(_Args...)>> : function_args<_Ret(_Args...)> {};
+template <typename _Signature>
+struct is_std_function<std::function<_Signature>> : std::true_type {};
+
+// index of the first std::function parameter, the arity if there is none
+template <typename _Args, std::size_t _Index = 0, bool _End = (_Index >= _Args::arity)>
+struct callback_index
+    : std::integral_constant<std::size_t, is_std_function<typename _Args::template arg_t<_Index>>{}
+                                              ? _Index
+                                              : callback_index<_Args, _Index + 1>{}> {};
+
+template <typename _Args, std::size_t _Index>
+struct callback_index<_Args, _Index, true> : std::integral_constant<std::size_t, _Index> {};
+
+template <std::size_t _Arg, typename _Tuple, typename _Callback>
+auto&& bulk_arg(_Tuple& args, _Callback&, std::integral_constant<int, -1>) {
+    return std::get<_Arg>(std::move(args));
+}
+
+template <std::size_t _Arg, typename _Tuple, typename _Callback>
+auto&& bulk_arg(_Tuple&, _Callback& callback, std::integral_constant<int, 0>) {
+    return std::move(callback);
+}
+
+template <std::size_t _Arg, typename _Tuple, typename _Callback>
+auto&& bulk_arg(_Tuple& args, _Callback&, std::integral_constant<int, 1>) {
+    return std::get<_Arg - 1>(std::move(args));
+}
 
-template <typename _Ret, typename _Ty, typename... _Args>
-struct function_args<_Ret (_Ty::*)(_Args...)> : function_args<_Ret(_Args...)> {};
+// calls func with the arguments of args and callback inserted at _Index
+template <std::size_t _Index, typename _Func, typename _Tuple, typename _Callback>
+void invoke_with_callback(_Func& func, _Tuple args, _Callback& callback) {
+    index_apply<std::tuple_size<_Tuple>{} + 1>([&](auto... _Indexes) {
+        func(bulk_arg<_Indexes>(args, callback,
+                                std::integral_constant<int, (_Indexes < _Index) ? -1 : (_Indexes == _Index) ? 0 : 1>{})...);
+    });
+}
 
-template <typename _Ret, typename _Ty, typename... _Args>
-struct function_args<_Ret (_Ty::*)(_Args...) const> : function_args<_Ret(_Args...)> {};
+} // namespace detail
 
+// the results of a bulk call, co_await or get() yield a std::vector of them in call order,
+// void when the callback has no arguments. the first failed call by index rethrows its exception.
 template <typename _Ty>
-struct function_args : function_args<decltype(&_Ty::operator())> {};
-
-#if defined(ENABLE_CO_AWAIT)
-class awaitable_promise_base {
+class bulk_future {
 public:
-    awaitable_promise_base() noexcept : state_{std::make_unique<state>()} {
-    }
+    bulk_future() noexcept = default;
+    bulk_future(const bulk_future&) = delete;
+    bulk_future& operator=(const bulk_future&) = delete;
 
-    awaitable_promise_base(const awaitable_promise_base&) = delete;
-    awaitable_promise_base& operator=(const awaitable_promise_base&) = delete;
+    explicit bulk_future(detail::bulk_state<_Ty>* state) noexcept : state_{state} {
+    }
 
-    awaitable_promise_base(awaitable_promise_base&& rhs) noexcept {
-        assign_rv(std::move(rhs));
+    bulk_future(bulk_future&& rhs) noexcept : state_{rhs.state_} {
+        rhs.state_ = nullptr;
     }
 
-    awaitable_promise_base& operator=(awaitable_promise_base&& rhs) noexcept {
-        assign_rv(std::move(rhs));
+    bulk_future& operator=(bulk_future&& rhs) noexcept {
+        if (std::addressof(rhs) != this) {
+            reset();
+            state_ = rhs.state_;
+            rhs.state_ = nullptr;
+        }
         return *this;
     }
 
-    void set_exception(std::exception_ptr exception) noexcept {
-        std::call_once(state_->flag(), [this, exception = std::move(exception)]() {
-            exception_ = std::move(exception);
-            state_->ready(true);
-            handle_.resume();
-        });
+    ~bulk_future() {
+        reset();
     }
 
+    std::size_t size() const noexcept {
+        return state_->size();
+    }
+
+    // every call completed
     bool ready() const noexcept {
         return state_->ready();
     }
 
-    void suspend(std::experimental::coroutine_handle<> handle) noexcept {
-        handle_ = std::move(handle);
+    bool ready(std::size_t index) const noexcept {
+        return (*state_)[index].ready();
+    }
+
+    // result of one call without waiting for the others, throws std::runtime_error if it is not ready
+    _Ty get(std::size_t index) {
+        return take((*state_)[index], std::is_void<_Ty>{});
     }
 
+    void wait() noexcept {
+        state_->wait();
+    }
+
+    auto get() {
+        wait();
+        return take_all(std::is_void<_Ty>{});
+    }
+
+#if defined(ENABLE_CO_AWAIT)
     // for coroutine
-    auto initial_suspend() noexcept {
-        return std::experimental::suspend_never{};
+    bool await_ready() const noexcept {
+        return state_->ready();
     }
 
     // for coroutine
-    auto final_suspend() noexcept {
-        return std::experimental::suspend_always{};
+    bool await_suspend(std::coroutine_handle<> handle) noexcept {
+        state_->waiter(handle);
+        return !state_->seal();
     }
 
     // for coroutine
-    void unhandled_exception() {
-        set_exception(std::current_exception());
+    auto await_resume() {
+        return take_all(std::is_void<_Ty>{});
     }
+#endif // defined(ENABLE_CO_AWAIT)
 
-    void rethrow_exception() {
-        if (exception_) {
-            std::rethrow_exception(exception_);
-        }
+private:
+    using slot_type = typename detail::bulk_state<_Ty>::slot;
+
+    static void take(slot_type& slot, std::true_type) {
+        slot.take();
     }
 
-    void swap(awaitable_promise_base& other) noexcept {
-        if (this != std::addressof(other)) {
-            std::swap(handle_, other.handle_);
-            std::swap(exception_, other.exception_);
-            std::swap(state_, other.state_);
-        }
+    static _Ty take(slot_type& slot, std::false_type) {
+        return slot.take();
     }
 
-protected:
-    struct state final {
-        bool ready() const noexcept {
-            return ready_;
+    void take_all(std::true_type) {
+        for (std::size_t i = 0; i < state_->size(); ++i) {
+            (*state_)[i].take();
         }
+    }
 
-        void ready(bool ready) noexcept {
-            ready_ = ready;
+    std::vector<_Ty> take_all(std::false_type) {
+        std::vector<_Ty> results;
+        results.reserve(state_->size());
+        for (std::size_t i = 0; i < state_->size(); ++i) {
+            results.push_back((*state_)[i].take());
         }
+        return results;
+    }
 
-        std::once_flag& flag() noexcept {
-            return flag_;
+    void reset() noexcept {
+        if (state_) {
+            state_->release();
         }
+        state_ = nullptr;
+    }
 
-    private:
-        std::once_flag flag_;
-        std::atomic_bool ready_{false};
-    };
+    detail::bulk_state<_Ty>* state_{nullptr};
+};
 
-    std::experimental::coroutine_handle<> handle_;
-    std::exception_ptr exception_{nullptr};
-    std::unique_ptr<state> state_{nullptr};
+// calls func once per element of range, a tuple of func's arguments without the callback.
+// the callback goes to func's first std::function parameter, all completion states share one allocation.
+// both placeholder::std_future and placeholder::awaitable yield a bulk_future.
+template <typename _Func, typename _Range, typename _Placeholder>
+auto async_wrapper_bulk(_Func&& func, _Range&& range, _Placeholder) {
+    static_assert(std::is_same<_Placeholder, detail::placeholder_std_future_t>{} ||
+                      std::is_same<_Placeholder, detail::placeholder_awaitable_t>{},
+                  "bulk calls take placeholder::std_future or placeholder::awaitable");
+    using args_t = detail::function_args<std::decay_t<_Func>>;
+    constexpr std::size_t index = detail::callback_index<args_t>{};
+    static_assert(index < args_t::arity, "no std::function parameter for the callback");
+    using callback_t = typename args_t::template arg_t<index>;
+    using result_t = detail::callback_result_t<callback_t>;
 
-private:
-    void assign_rv(awaitable_promise_base&& other) noexcept {
-        if (this != std::addressof(other)) {
-            handle_ = nullptr;
-            exception_ = nullptr;
-            state_.reset();
-            swap(other);
+    using std::begin;
+    using std::end;
+    auto first = begin(range);
+    const auto last = end(range);
+    const auto count = static_cast<std::size_t>(std::distance(first, last));
+    auto state = detail::bulk_state<result_t>::create(count);
+    bulk_future<result_t> future{state};
+    std::size_t i{0};
+    try {
+        for (; first != last; ++first, ++i) {
+            auto callback = detail::make_callback<callback_t>(&(*state)[i]);
+            try {
+                detail::invoke_with_callback<index>(func, *first, callback);
+            } catch (...) {
+                // unless it called back before throwing
+                if ((*state)[i].claim_callback()) {
+                    (*state)[i].set_exception(std::current_exception());
+                }
+                throw;
+            }
         }
+    } catch (...) {
+        // the calls never made hold the callback references nobody took
+        while (++i < count) {
+            (*state)[i].claim_callback();
+            (*state)[i].set_exception(std::current_exception());
+            (*state)[i].drop_callback();
+        }
+        throw;
     }
+    return future;
+}
+
+#if defined(ENABLE_CO_AWAIT)
+// what a full stream does with the next event
+enum class stream_overflow {
+    // the producer waits for the consumer
+    block,
+    // the oldest queued event is discarded
+    drop_oldest,
+    // the newest queued event is replaced
+    coalesce,
+};
+
+namespace detail {
+
+struct placeholder_stream_t final {
+    std::size_t capacity;
+    stream_overflow overflow;
+};
+
+template <>
+struct is_placeholder<placeholder_stream_t> : std::true_type {};
+
+// a suspended next(), handed to the producer that publishes the next event or ends the stream
+struct stream_waiter {
+    // posts handle to executor, null resumes it on the producer's thread
+    void (*post)(void* executor, std::coroutine_handle<> handle);
+    void* executor;
+    std::coroutine_handle<> handle;
 };
 
+// bounded ring between one producer, the callback, and one consumer, the async_stream.
+// with stream_overflow::block it is a plain SPSC ring, head_ is the consumer's and tail_ the producer's.
+// drop_oldest and coalesce let the producer reach into the consumer's end: there head_ is advanced by
+// CAS from both ends, and a per-slot flag keeps the producer off a slot the consumer is still moving
+// out of and the consumer off the newest slot while coalesce rewrites it.
+// copies of the callback may live on any thread, but must not fire concurrently.
 template <typename _Ty>
-class awaitable_promise final : public awaitable_promise_base {
+class stream_state final {
 public:
-    using promise_type = awaitable_promise<_Ty>;
-    using future_type = awaitable_future<_Ty>;
+    static stream_state* create(std::size_t capacity, stream_overflow overflow) {
+        std::size_t size{2};
+        while (size < capacity) {
+            size <<= 1;
+        }
+        static_assert(alignof(_Ty) <= alignof(std::max_align_t), "over-aligned type");
+        auto raw = ::operator new(slots_offset() + size * sizeof(slot));
+        auto state = ::new (raw) stream_state{size, overflow};
+        for (std::size_t i = 0; i < size; ++i) {
+            ::new (static_cast<void*>(state->slots() + i)) slot{};
+        }
+        return state;
+    }
 
-    awaitable_promise() noexcept = default;
-    awaitable_promise(const awaitable_promise&) = delete;
-    awaitable_promise& operator=(const awaitable_promise&) = delete;
-    awaitable_promise(awaitable_promise&&) = default;
-    awaitable_promise& operator=(awaitable_promise&&) = default;
+    void release() noexcept {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+        }
+    }
 
-    future_type get_future() {
-        return future_type{this};
+    // every copy of the callback is a producer, the stream ends when the last one is destroyed
+    void add_producer() noexcept {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+        producers_.fetch_add(1, std::memory_order_relaxed);
     }
 
-    // for coroutine
-    future_type get_return_object() noexcept {
-        return future_type{this};
-    };
+    void remove_producer() noexcept {
+        if (producers_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            closed_.store(true, std::memory_order_seq_cst);
+            wake_consumer();
+        }
+        release();
+    }
 
-    // for coroutine
-    template <typename _Value>
-    void return_value(_Value&& value) {
-        set_value(std::forward<_Value>(value));
+    // for the callback, pushes one event
+    template <typename... _Args>
+    void emplace_value(_Args&&... args) {
+        push(_Ty(std::forward<_Args>(args)...));
     }
 
-    template <typename _Value>
-    void set_value(_Value&& value) {
-        std::call_once(state_->flag(), [this, value = std::forward<_Value>(value)]() {
-            result_ = std::move(value);
-            state_->ready(true);
-            handle_.resume();
-        });
+    // the consumer is gone, events are dropped from now on
+    void cancel() noexcept {
+        cancelled_.store(true, std::memory_order_seq_cst);
+        wake_producer();
     }
 
-    _Ty get() {
-        if (!state_->ready()) {
-            exception_ = std::make_exception_ptr(std::runtime_error{"no value"});
+    bool ready() const noexcept {
+        return closed_.load(std::memory_order_acquire) ||
+               head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_acquire);
+    }
+
+    bool try_pop(_Ty& out) {
+        if (overflow_ != stream_overflow::block) {
+            return try_pop_shared(out);
         }
-        rethrow_exception();
-        return std::move(result_);
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        auto& item = at(head);
+        out = std::move(item.value());
+        item.value().~_Ty();
+        head_.store(head + 1, std::memory_order_release);
+        wake_producer();
+        return true;
+    }
+
+    // false if an event or the end is there already, the coroutine then goes on inline
+    bool suspend(stream_waiter* waiter) noexcept {
+        // once published the coroutine may run elsewhere and drop the stream, this holds it meanwhile
+        refs_.fetch_add(1, std::memory_order_relaxed);
+        waiter_.store(waiter, std::memory_order_seq_cst);
+        auto suspended = true;
+        if (ready()) {
+            // the producer may have taken the waiter and resume it, that one wins
+            suspended = !waiter_.exchange(nullptr, std::memory_order_acq_rel);
+        }
+        release();
+        return suspended;
     }
 
 private:
-    _Ty result_;
-};
+    struct slot final {
+        _Ty& value() noexcept {
+            return *reinterpret_cast<_Ty*>(&storage);
+        }
 
-template <>
-class awaitable_promise<void> final : public awaitable_promise_base {
-public:
-    using promise_type = awaitable_promise<void>;
-    using future_type = awaitable_future<void>;
+        std::atomic<std::uint32_t> flag{empty};
+        typename std::aligned_storage<sizeof(_Ty), alignof(_Ty)>::type storage;
+    };
 
-    awaitable_promise() noexcept = default;
-    awaitable_promise(const awaitable_promise&) = delete;
-    awaitable_promise& operator=(const awaitable_promise&) = delete;
-    awaitable_promise(awaitable_promise&&) = default;
-    awaitable_promise& operator=(awaitable_promise&&) = default;
+    static constexpr std::uint32_t empty{0};
+    static constexpr std::uint32_t full{1};
+    static constexpr std::uint32_t reading{2};
+    static constexpr std::uint32_t writing{3};
 
-    future_type get_future() {
-        return future_type{this};
+    stream_state(std::size_t capacity, stream_overflow overflow) noexcept
+        : capacity_{capacity}, mask_{capacity - 1}, overflow_{overflow} {
     }
 
-    // for coroutine
-    future_type get_return_object() noexcept {
-        return future_type{this};
-    };
+    static constexpr std::size_t slots_offset() noexcept {
+        return (sizeof(stream_state) + alignof(slot) - 1) / alignof(slot) * alignof(slot);
+    }
 
-    // for coroutine
-    void return_void() {
+    slot* slots() noexcept {
+        return reinterpret_cast<slot*>(reinterpret_cast<char*>(this) + slots_offset());
     }
 
-    void set_value() {
-        std::call_once(state_->flag(), [this]() {
-            state_->ready(true);
-            handle_.resume();
-        });
+    slot& at(std::uint64_t index) noexcept {
+        return slots()[index & mask_];
     }
 
-    void get() {
-        if (!state_->ready()) {
-            exception_ = std::make_exception_ptr(std::runtime_error{"no value"});
+    bool try_pop_shared(_Ty& out) {
+        for (;;) {
+            auto head = head_.load(std::memory_order_acquire);
+            if (head == tail_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            // fails when the producer dropped it
+            if (!head_.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel)) {
+                continue;
+            }
+            auto& item = at(head);
+            // coalesce may be rewriting it
+            auto expected = full;
+            while (!item.flag.compare_exchange_weak(expected, reading, std::memory_order_acquire)) {
+                expected = full;
+                std::this_thread::yield();
+            }
+            out = std::move(item.value());
+            item.value().~_Ty();
+            item.flag.store(empty, std::memory_order_release);
+            wake_producer();
+            return true;
         }
-        rethrow_exception();
     }
-};
-#endif // defined(ENABLE_CO_AWAIT)
 
-template <typename _Func, std::size_t... _Indexes>
-constexpr auto index_apply_impl(_Func&& func, std::index_sequence<_Indexes...>) {
-    return func(std::integral_constant<std::size_t, _Indexes>{}...);
-}
+    void push(_Ty&& value) {
+        if (cancelled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (overflow_ != stream_overflow::block) {
+            if (!push_shared(tail, value)) {
+                return;
+            }
+        } else {
+            while (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+                if (!wait_for_room(tail)) {
+                    return;
+                }
+            }
+            ::new (static_cast<void*>(&at(tail).storage)) _Ty(std::move(value));
+        }
+        tail_.store(tail + 1, std::memory_order_seq_cst);
+        wake_consumer();
+    }
 
-template <std::size_t _Index, typename _Func>
-constexpr auto index_apply(_Func&& func) {
-    return index_apply_impl(std::forward<_Func>(func), std::make_index_sequence<_Index>{});
-}
+    // false if value was coalesced into the newest queued event, tail_ stays then
+    bool push_shared(std::uint64_t tail, _Ty& value) {
+        for (;;) {
+            auto head = head_.load(std::memory_order_acquire);
+            if (tail - head < capacity_) {
+                break;
+            }
+            if (overflow_ == stream_overflow::drop_oldest) {
+                if (head_.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel)) {
+                    // won against the consumer, the slot is ours and tail goes there next
+                    at(head).value().~_Ty();
+                    at(head).flag.store(empty, std::memory_order_relaxed);
+                    break;
+                }
+            } else {
+                auto& newest = at(tail - 1);
+                auto expected = full;
+                if (newest.flag.compare_exchange_strong(expected, writing, std::memory_order_acquire)) {
+                    newest.value() = std::move(value);
+                    newest.flag.store(full, std::memory_order_release);
+                    return false;
+                }
+            }
+        }
+        auto& item = at(tail);
+        // the consumer may still be moving the previous event out
+        while (item.flag.load(std::memory_order_acquire) != empty) {
+            std::this_thread::yield();
+        }
+        ::new (static_cast<void*>(&item.storage)) _Ty(std::move(value));
+        item.flag.store(full, std::memory_order_release);
+        return true;
+    }
 
-template <std::size_t _Index, typename _Tuple>
-constexpr auto take_front(_Tuple&& tp) {
-    return index_apply<_Index>(
-        [&](auto... _Indexes) { return std::make_tuple(std::get<_Indexes>(std::forward<_Tuple>(tp))...); });
-}
+    // false if the consumer went away meanwhile
+    bool wait_for_room(std::uint64_t tail) noexcept {
+        const auto popped = popped_.load(std::memory_order_acquire);
+        producer_waiting_.store(true, std::memory_order_relaxed);
+        // pairs with the fence in wake_producer(), either we see the room or it sees us waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (tail - head_.load(std::memory_order_relaxed) >= capacity_ && !cancelled_.load(std::memory_order_relaxed)) {
+            atomic_wait(popped_, popped);
+        }
+        producer_waiting_.store(false, std::memory_order_relaxed);
+        return !cancelled_.load(std::memory_order_acquire);
+    }
 
-template <typename _Tuple, typename _Func>
-constexpr auto apply(_Tuple&& tp, _Func&& func) {
-    return index_apply<std::tuple_size<_Tuple>{}>(
-        [&](auto... _Indexes) { return func(std::get<_Indexes>(std::forward<_Tuple>(tp))...); });
-}
+    void wake_producer() noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producer_waiting_.load(std::memory_order_relaxed)) {
+            popped_.fetch_add(1, std::memory_order_release);
+            atomic_notify_one(popped_);
+        }
+    }
 
-template <typename _Tuple>
-constexpr auto reverse(const _Tuple& tp) {
-    return index_apply<std::tuple_size<_Tuple>{}>(
-        [&](auto... _Indexes) { return std::make_tuple(std::get<std::tuple_size<_Tuple>{} - 1 - _Indexes>(tp)...); });
-}
+    void wake_consumer() noexcept {
+        while (waiter_.load(std::memory_order_seq_cst)) {
+            auto waiter = waiter_.exchange(nullptr, std::memory_order_seq_cst);
+            if (!waiter) {
+                return;
+            }
+            if (ready()) {
+                // the waiter lives in the coroutine frame, gone as soon as the coroutine runs elsewhere
+                const auto handle = waiter->handle;
+                if (waiter->post) {
+                    waiter->post(waiter->executor, handle);
+                } else {
+                    handle.resume();
+                }
+                return;
+            }
+            // registered after the consumer took the event we published, it waits for the next one.
+            // an event or the end arriving meanwhile found no waiter, so look again once it is back.
+            waiter_.store(waiter, std::memory_order_seq_cst);
+            if (!ready()) {
+                return;
+            }
+        }
+    }
 
-template <typename _Tuple, std::size_t _Index, typename _Ty,
-          typename _Indexes = std::make_index_sequence<std::tuple_size<_Tuple>{}>>
-struct replace_type_by_index;
+    void destroy() noexcept {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        for (auto i = head_.load(std::memory_order_relaxed); i != tail; ++i) {
+            at(i).value().~_Ty();
+        }
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            slots()[i].~slot();
+        }
+        this->~stream_state();
+        ::operator delete(this);
+    }
 
-template <typename... _Args, std::size_t _Index, typename _Ty, std::size_t... _Indexes>
-struct replace_type_by_index<std::tuple<_Args...>, _Index, _Ty, std::index_sequence<_Indexes...>> {
-    using type = std::tuple<std::conditional_t<_Indexes == _Index, _Ty, _Args>...>;
+    const std::size_t capacity_;
+    const std::size_t mask_;
+    const stream_overflow overflow_;
+    std::atomic<std::size_t> refs_{1};
+    std::atomic<std::size_t> producers_{0};
+    std::atomic<stream_waiter*> waiter_{nullptr};
+    std::atomic_bool closed_{false};
+    std::atomic_bool cancelled_{false};
+    std::atomic_bool producer_waiting_{false};
+    std::atomic<std::uint32_t> popped_{0};
+    // consumer and producer ends on their own lines
+    char head_padding_[64];
+    std::atomic<std::uint64_t> head_{0};
+    char tail_padding_[64 - sizeof(std::atomic<std::uint64_t>)];
+    std::atomic<std::uint64_t> tail_{0};
+    char slots_padding_[64 - sizeof(std::atomic<std::uint64_t>)];
 };
 
-template <std::size_t _Index, typename _Tuple, typename _Ty>
-constexpr auto replace_tuple_arg_by_index(const _Tuple& tp, _Ty&& t) {
-    return std::tuple_cat(take_front<_Index>(tp), std::make_tuple(std::forward<_Ty>(t)),
-                          reverse(take_front<std::tuple_size<_Tuple>{} - _Index - 1>(reverse(tp))));
-}
-
-template <std::size_t _Index, typename _Ty, typename... _Args>
-constexpr auto replace_arg_by_index(_Ty&& t, _Args&&... args) {
-    auto args_tuple = std::make_tuple(std::forward<_Args>(args)...);
-    return replace_tuple_arg_by_index<_Index>(args_tuple, std::forward<_Ty>(t));
-}
+// a producer reference, unlike completion_handler it may fire any number of times
+template <typename _Ty>
+class stream_handler final {
+public:
+    explicit stream_handler(stream_state<_Ty>* state) noexcept : state_{state} {
+        state_->add_producer();
+    }
 
-template <typename _Ty, typename _Func>
-constexpr auto replace_arg_impl(_Ty&& t, _Func&& f, std::true_type) {
-    return std::forward<_Func>(f);
-}
+    stream_handler(const stream_handler& rhs) noexcept : state_{rhs.state_} {
+        state_->add_producer();
+    }
 
-template <typename _Ty, typename _Func>
-constexpr auto replace_arg_impl(_Ty&& t, _Func&& f, std::false_type) {
-    return std::forward<_Ty>(t);
-}
+    stream_handler& operator=(const stream_handler&) = delete;
 
-template <bool _True, typename _Ty, typename _Func>
-constexpr auto replace_arg(_Ty&& t, _Func&& f) {
-    return replace_arg_impl(std::forward<_Ty>(t), std::forward<_Func>(f), std::integral_constant<bool, _True>{});
-}
+    ~stream_handler() {
+        state_->remove_producer();
+    }
 
-template <typename _Ty, typename _Func>
-constexpr auto replace_std_future(_Ty&& t, _Func&& f) {
-    return replace_arg<is_std_future_placeholder<_Ty>{}>(std::forward<_Ty>(t), std::forward<_Func>(f));
-}
+    template <typename... _Args>
+    void operator()(_Args&&... args) const {
+        apply_callback(state_, std::forward<_Args>(args)...);
+    }
 
-template <typename _Ty, typename _Func>
-constexpr auto replace_awaitable(_Ty&& t, _Func&& f) {
-    return replace_arg<is_awaitable_placeholder<_Ty>{}>(std::forward<_Ty>(t), std::forward<_Func>(f));
-}
+private:
+    stream_state<_Ty>* state_;
+};
 
-template <typename _Promise>
-void apply_callback(_Promise promise) {
-    promise->set_value();
+template <typename _Ty>
+stream_handler<_Ty> make_handler(stream_state<_Ty>* state) noexcept {
+    return stream_handler<_Ty>{state};
 }
 
-template <typename _Promise, typename _Arg>
-void apply_callback(_Promise promise, _Arg&& arg) {
-    promise->set_value(std::forward<_Arg>(arg));
+// a throwing func just ends the stream, once its callbacks are gone
+template <typename _Ty, typename _Func, typename _Args>
+void call_callee(stream_state<_Ty>*, _Func&& func, _Args&& args) {
+    detail::apply(std::move(args), std::forward<_Func>(func));
 }
 
-template <typename _Promise, typename... _Args>
-void apply_callback(_Promise promise, _Args&&... args) {
-    promise->set_value(std::make_tuple(std::forward<_Args>(args)...));
-}
+} // namespace detail
 
-template <typename _Callback, template <typename> class _Promise>
-class callback_wrapper final : public std::enable_shared_from_this<callback_wrapper<_Callback, _Promise>> {
+// the events of a placeholder::stream call, consumed with
+//   _Ty event;
+//   while (co_await stream.next(event)) { ... }
+// next() yields false once every copy of the callback was destroyed and all events were taken.
+// next(out) resumes the coroutine on the producer's thread, next(out, executor) posts it to executor
+// instead, which is referenced and must outlive the wait. executor needs void post(F f) as for awaitable_on.
+template <typename _Ty>
+class async_stream {
 public:
-    using promise_type = _Promise<typename function_args<_Callback>::args_tuple>;
+    async_stream() noexcept = default;
+    async_stream(const async_stream&) = delete;
+    async_stream& operator=(const async_stream&) = delete;
+
+    explicit async_stream(detail::stream_state<_Ty>* state) noexcept : state_{state} {
+    }
+
+    async_stream(async_stream&& rhs) noexcept : state_{rhs.state_} {
+        rhs.state_ = nullptr;
+    }
+
+    async_stream& operator=(async_stream&& rhs) noexcept {
+        if (std::addressof(rhs) != this) {
+            reset();
+            state_ = rhs.state_;
+            rhs.state_ = nullptr;
+        }
+        return *this;
+    }
+
+    ~async_stream() {
+        reset();
+    }
+
+    class next_awaiter {
+    public:
+        // for coroutine
+        bool await_ready() const noexcept {
+            return state_->ready();
+        }
+
+        // for coroutine
+        bool await_suspend(std::coroutine_handle<> handle) noexcept {
+            waiter_.handle = handle;
+            return state_->suspend(&waiter_);
+        }
+
+        // for coroutine
+        bool await_resume() {
+            return state_->try_pop(*out_);
+        }
+
+    private:
+        friend class async_stream;
+
+        next_awaiter(detail::stream_state<_Ty>* state, _Ty* out, detail::stream_waiter waiter) noexcept
+            : state_{state}, out_{out}, waiter_{waiter} {
+        }
+
+        detail::stream_state<_Ty>* state_;
+        _Ty* out_;
+        detail::stream_waiter waiter_;
+    };
 
-    callback_wrapper() noexcept : promise_{std::make_shared<promise_type>()} {
+    // moves the next event into out, false at the end of the stream
+    next_awaiter next(_Ty& out) noexcept {
+        return next_awaiter{state_, std::addressof(out), {nullptr, nullptr, nullptr}};
     }
 
-    auto get_future() {
-        return promise_->get_future();
+    // as above, but a coroutine that had to wait is resumed on executor
+    template <typename _Executor>
+    next_awaiter next(_Ty& out, _Executor& executor) noexcept {
+        auto address = const_cast<void*>(static_cast<const void*>(std::addressof(executor)));
+        return next_awaiter{state_, std::addressof(out), {&post_to<_Executor>, address, nullptr}};
     }
 
-    auto callback() {
-        typename function_args<_Callback>::function_type callback{
-            [this, self = this->shared_from_this()](auto&&... args) {
-                apply_callback(promise_, std::forward<decltype(args)>(args)...);
-            }};
-        return callback;
+    // never waits, false if no event is queued
+    bool try_next(_Ty& out) {
+        return state_->try_pop(out);
     }
 
 private:
-    std::shared_ptr<promise_type> promise_;
-};
+    template <typename _Executor>
+    static void post_to(void* executor, std::coroutine_handle<> handle) {
+        static_cast<_Executor*>(executor)->post(handle);
+    }
 
-template <typename _Func, typename... _Args>
-auto async_wrapper_impl(std::true_type, _Func&& func, _Args&&... args) {
-    constexpr std::size_t index = std_future_index<std::tuple<std::decay_t<_Args>...>>{};
-    using callback_t = typename function_args<std::decay_t<_Func>>::template arg_t<index>;
-    auto wrapper = std::make_shared<callback_wrapper<callback_t, std::promise>>();
-    // 1.
-    // detail::apply(replace_arg_by_index<index>(wrapper->callback(), std::forward<_Args>(args)...),
-    //               std::forward<_Func>(func));
+    void reset() noexcept {
+        if (state_) {
+            state_->cancel();
+            state_->release();
+        }
+        state_ = nullptr;
+    }
 
-    // 2.
-    // auto args_tupe = std::make_tuple(std::forward<_Args>(args)...);
-    // auto tp = replace_tuple_arg_by_index<index>(args_tupe, wrapper->callback());
-    // detail::apply(std::move(tp), std::forward<_Func>(func));
+    detail::stream_state<_Ty>* state_{nullptr};
+};
+
+namespace detail {
 
-    // 3.
-    detail::apply(std::make_tuple(replace_std_future(std::forward<_Args>(args), wrapper->callback())...),
-                  std::forward<_Func>(func));
-    return wrapper->get_future();
+template <typename _Callback, typename _Alloc>
+auto make_completion(const _Alloc&, const placeholder_stream_t& placeholder) {
+    using value_t = when_result_t<callback_result_t<_Callback>>;
+    auto state = stream_state<value_t>::create(placeholder.capacity, placeholder.overflow);
+    return std::make_pair(state, async_stream<value_t>{state});
 }
 
-#if defined(ENABLE_CO_AWAIT)
-template <typename _Func, typename... _Args>
-auto async_wrapper_impl(std::false_type, _Func&& func, _Args&&... args) {
-    constexpr std::size_t index = awaitable_index<std::tuple<std::decay_t<_Args>...>>{};
-    using callback_t = typename function_args<std::decay_t<_Func>>::template arg_t<index>;
-    auto wrapper = std::make_shared<callback_wrapper<callback_t, awaitable_promise>>();
-    detail::apply(std::make_tuple(replace_awaitable(std::forward<_Args>(args), wrapper->callback())...),
-                  std::forward<_Func>(func));
-    return wrapper->get_future();
+} // namespace detail
+
+namespace placeholder {
+
+// the callback may fire any number of times, the call returns an async_stream.
+// events are queued in a ring of capacity slots allocated once per call.
+constexpr detail::placeholder_stream_t stream{64, stream_overflow::block};
+
+constexpr detail::placeholder_stream_t stream_with(std::size_t capacity,
+                                                   stream_overflow overflow = stream_overflow::block) {
+    return {capacity, overflow};
 }
+
+} // namespace placeholder
 #endif // defined(ENABLE_CO_AWAIT)
 
-} // namespace detail
+#if defined(ENABLE_INSTRUMENTATION)
+// statistics of wrapped calls, compiled in with ENABLE_INSTRUMENTATION. a call is launched by
+// async_wrapper and completed when its callback fires, bulk and stream calls are not recorded.
+namespace instrumentation {
 
-template <typename _Func, typename... _Args, typename _Tuple = std::tuple<std::decay_t<_Args>...>>
-auto async_wrapper(_Func&& func, _Args&&... args) {
-    return detail::async_wrapper_impl(detail::has_std_future<_Tuple>{}, std::forward<_Func>(func),
-                                      std::forward<_Args>(args)...);
+// calls launched and not yet completed or abandoned
+inline std::int64_t in_flight() noexcept {
+    return detail::in_flight_calls().load(std::memory_order_relaxed);
+}
+
+// keeps the last 65536 completed calls for write_chrome_trace, off by default
+inline void enable_trace(bool enabled) {
+    if (enabled) {
+        detail::trace_buffer::instance();
+    }
+    detail::trace_buffer::enabled().store(enabled, std::memory_order_relaxed);
+}
+
+// one line per callee, latencies in microseconds
+inline void write_summary(std::ostream& out) {
+    char line[256];
+    std::snprintf(line, sizeof(line), "in flight %lld\n", static_cast<long long>(in_flight()));
+    out << line;
+    detail::call_site_registry::instance().for_each([&](const detail::call_site& site) {
+        const auto launched = site.launched.load(std::memory_order_relaxed);
+        const auto completed = site.completed.load(std::memory_order_relaxed);
+        const auto abandoned = site.abandoned.load(std::memory_order_relaxed);
+        std::snprintf(line, sizeof(line),
+                      "launched %llu completed %llu abandoned %llu p50 %.2f p90 %.2f p99 %.2f p999 %.2f max %.2f us ",
+                      static_cast<unsigned long long>(launched), static_cast<unsigned long long>(completed),
+                      static_cast<unsigned long long>(abandoned), site.latency.quantile(0.5) / 1e3,
+                      site.latency.quantile(0.9) / 1e3, site.latency.quantile(0.99) / 1e3,
+                      site.latency.quantile(0.999) / 1e3, site.latency.quantile(1.0) / 1e3);
+        out << line << site.name << '\n';
+    });
+}
+
+// trace event json of the buffered calls, loadable by chrome://tracing and perfetto.
+// each call is a complete event on the launching thread.
+inline void write_chrome_trace(std::ostream& out) {
+    out << "{\"traceEvents\":[";
+    const char* separator = "";
+    char fields[192];
+    detail::trace_buffer::instance().for_each([&](const detail::call_site& site, std::int64_t begin,
+                                                  std::int64_t end, std::uint32_t launch_thread,
+                                                  std::uint32_t complete_thread) {
+        out << separator << "{\"name\":\"";
+        for (auto c : site.name) {
+            if (c == '"' || c == '\\') {
+                out << '\\';
+            }
+            out << c;
+        }
+        std::snprintf(fields, sizeof(fields),
+                      "\",\"cat\":\"async_wrapper\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,"
+                      "\"args\":{\"completed_on\":%u}}",
+                      begin / 1e3, (end - begin) / 1e3, launch_thread, complete_thread);
+        out << fields;
+        separator = ",\n";
+    });
+    out << "],\"displayTimeUnit\":\"ns\"}\n";
 }
 
+} // namespace instrumentation
+#endif // defined(ENABLE_INSTRUMENTATION)
+
 } // namespace cue
 
+namespace std {
+
+// the wrapped promise decides, so std::promise still takes the allocator of the completion state
+template <typename _Promise, typename _Alloc>
+struct uses_allocator<cue::detail::cancellable_promise<_Promise>, _Alloc> : uses_allocator<_Promise, _Alloc> {};
+
+template <typename _Promise, typename _Expected, typename _Alloc>
+struct uses_allocator<cue::detail::expected_promise<_Promise, _Expected>, _Alloc> : uses_allocator<_Promise, _Alloc> {};
+
+template <typename _Promise, typename _Alloc>
+struct uses_allocator<cue::detail::limited_promise<_Promise>, _Alloc> : uses_allocator<_Promise, _Alloc> {};
+
+} // namespace std
+
 #endif // ASYNC_WRAPPER_HPP_
@@ -0,0 +1,290 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// 统计每次包装调用的堆分配次数
+// g++ -std=c++14 -O2 -I.. allocation_count.cpp -pthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <async_wrapper.hpp>
+#include <single_flight.hpp>
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+
+std::function<void(int)> g_pending;
+
+void inline_callee(int a, std::function<void(int)> f) {
+    f(a);
+}
+
+void deferred_callee(int a, std::function<void(int)> f) {
+    g_pending = std::move(f);
+    (void)a;
+}
+
+void failing_callee(int a, std::function<void(std::error_code, int)> f) {
+    f(std::make_error_code(std::errc::io_error), a);
+}
+
+struct sink final {
+    int* value;
+
+    void set_value(int v) noexcept {
+        *value = v;
+    }
+
+    void set_error(std::exception_ptr) noexcept {
+    }
+};
+
+template <typename _Func>
+void run(const char* name, std::size_t count, _Func&& func, std::size_t batch = 1) {
+    const auto allocations = g_allocations.load();
+    const auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i += batch) {
+        func(static_cast<int>(i));
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    std::printf("%-32s %8.2f allocs/call %8.1f ns/call\n", name,
+                static_cast<double>(g_allocations.load() - allocations) / count, static_cast<double>(ns) / count);
+}
+
+} // namespace
+
+// every form of new and delete is replaced, on malloc and free. gcc still reports free on a pointer from
+// operator new once both are inlined into one caller, which is what these replacements mean to do.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+int main() {
+    using namespace cue;
+    constexpr std::size_t count{1000000};
+
+    run("std_future inline", count, [](int i) {
+        auto future = async_wrapper(inline_callee, i, placeholder::std_future);
+        future.get();
+    });
+
+    run("std_future deferred", count, [](int i) {
+        auto future = async_wrapper(deferred_callee, i, placeholder::std_future);
+        g_pending(i);
+        future.get();
+    });
+
+    run("std_future recycling_allocator", count, [](int i) {
+        auto future =
+            async_wrapper(std::allocator_arg, recycling_allocator<void>{}, deferred_callee, i, placeholder::std_future);
+        g_pending(i);
+        future.get();
+    });
+
+    run("blocking inline", count, [](int i) {
+        auto future = async_wrapper(inline_callee, i, placeholder::blocking);
+        future.get();
+    });
+
+    run("blocking deferred", count, [](int i) {
+        auto future = async_wrapper(deferred_callee, i, placeholder::blocking);
+        g_pending(i);
+        future.get();
+    });
+
+    run("continuable then deferred", count, [](int i) {
+        auto future = async_wrapper(deferred_callee, i, placeholder::continuable).then([](int v) { return v + 1; });
+        g_pending(i);
+        future.get();
+    });
+
+    run("continuable then recycling", count, [](int i) {
+        auto future = async_wrapper(std::allocator_arg, recycling_allocator<void>{}, deferred_callee, i,
+                                    placeholder::continuable)
+                          .then([](int v) { return v + 1; });
+        g_pending(i);
+        future.get();
+    });
+
+    run("deferred connect/start", count, [](int i) {
+        int value{0};
+        auto operation = async_wrapper(deferred_callee, i, placeholder::deferred).connect(sink{&value});
+        operation.start();
+        g_pending(i);
+    });
+
+    {
+        async_semaphore semaphore{1};
+        run("std_future limited", count, [&](int i) {
+            auto future = async_wrapper(deferred_callee, i, placeholder::limited(semaphore, placeholder::std_future));
+            g_pending(i);
+            future.get();
+        });
+    }
+
+    {
+        auto flight = make_single_flight(&deferred_callee, single_flight_options{16, std::chrono::seconds{60}, 1024});
+        run("single_flight cached", count, [&](int i) {
+            auto future = flight(i % 64, placeholder::continuable);
+            if (!future.ready()) {
+                g_pending(i % 64);
+            }
+            future.get();
+        });
+    }
+
+    run("error thrown", count, [](int i) {
+        auto future = async_wrapper(failing_callee, i, placeholder::continuable)
+                          .then([](std::tuple<std::error_code, int> result) {
+                              if (std::get<0>(result)) {
+                                  throw std::system_error{std::get<0>(result)};
+                              }
+                              return std::get<1>(result);
+                          });
+        try {
+            future.get();
+        } catch (const std::system_error&) {
+        }
+    });
+
+    run("error as_expected", count, [](int i) {
+        auto future = async_wrapper(failing_callee, i, placeholder::as_expected(placeholder::continuable));
+        (void)future.get().error();
+    });
+
+    {
+        constexpr std::size_t batch{64};
+        std::vector<std::tuple<int>> keys(batch);
+        run("bulk std_future inline", count,
+            [&](int) { async_wrapper_bulk(inline_callee, keys, placeholder::std_future).get(); }, batch);
+    }
+
+#if defined(ENABLE_CO_AWAIT)
+    run("awaitable inline", count, [](int i) { async_wrapper(inline_callee, i, placeholder::awaitable); });
+
+    run("awaitable deferred", count, [](int i) {
+        auto future = async_wrapper(deferred_callee, i, placeholder::awaitable);
+        g_pending(i);
+    });
+
+    run("awaitable_st inline", count, [](int i) { async_wrapper(inline_callee, i, placeholder::awaitable_st); });
+
+    run("awaitable_st deferred", count, [](int i) {
+        auto future = async_wrapper(deferred_callee, i, placeholder::awaitable_st);
+        g_pending(i);
+    });
+
+    run("awaitable recycling_allocator", count, [](int i) {
+        auto future =
+            async_wrapper(std::allocator_arg, recycling_allocator<void>{}, deferred_callee, i, placeholder::awaitable);
+        g_pending(i);
+    });
+
+    {
+        std::vector<std::function<void(int)>> callbacks;
+        callbacks.reserve(count);
+        run("awaitable cross-thread pool", count, [&](int i) {
+            auto future = async_wrapper(std::allocator_arg, recycling_allocator<void>{},
+                                        [&](int, std::function<void(int)> f) { callbacks.push_back(std::move(f)); },
+                                        i, placeholder::awaitable);
+            if (callbacks.size() == 1024) {
+                std::thread{[&]() {
+                    for (auto& callback : callbacks) {
+                        callback(0);
+                    }
+                }}.join();
+                callbacks.clear();
+            }
+        });
+    }
+
+    run("coroutine spawn", count, [](int i) {
+        [](int i) -> awaitable_t<int> { co_return co_await async_wrapper(inline_callee, i, placeholder::awaitable); }(i);
+    });
+
+    run("coroutine spawn deferred", count, [](int i) {
+        [](int i) -> awaitable_t<int> { co_return co_await async_wrapper(deferred_callee, i, placeholder::deferred); }(i);
+        g_pending(i);
+    });
+
+    {
+        async_semaphore semaphore{1};
+        run("coroutine spawn deferred limited", count, [&](int i) {
+            auto limited = [&](int i) -> awaitable_t<int> {
+                co_return co_await async_wrapper(deferred_callee, i,
+                                                 placeholder::limited(semaphore, placeholder::deferred));
+            };
+            limited(i);
+            limited(i);
+            auto first = std::move(g_pending);
+            first(i);
+            g_pending(i);
+        }, 2);
+    }
+#endif // defined(ENABLE_CO_AWAIT)
+
+    const auto stats = recycling_allocator<void>::stats();
+    std::printf("pool hits %llu misses %llu remote frees %llu\n", static_cast<unsigned long long>(stats.hits),
+                static_cast<unsigned long long>(stats.misses), static_cast<unsigned long long>(stats.remote_frees));
+
+    return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// 各种完成方式在调用内同步完成、跨线程、多生产者汇聚下的吞吐、延迟分位数与每次调用的分配次数
+// cmake -S .. -B build && cmake --build build && build/async_wrapper_bench [calls per producer]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <async_wrapper.hpp>
+#include <run_loop.hpp>
+
+using namespace cue;
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+
+using samples_t = std::vector<std::int64_t>;
+
+std::int64_t now_ns() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+class worker final {
+public:
+    worker() {
+        queue_.reserve(1024);
+        thread_ = std::thread{[this]() { run(); }};
+    }
+
+    worker(const worker&) = delete;
+    worker& operator=(const worker&) = delete;
+
+    ~worker() {
+        stopped_.store(true, std::memory_order_release);
+        thread_.join();
+    }
+
+    void post(std::function<void(int)> callback, int value) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        queue_.emplace_back(std::move(callback), value);
+    }
+
+    template <typename _Func>
+    void post(_Func&& func) {
+        post([func](int) mutable { func(); }, 0);
+    }
+
+    bool running_in_this_thread() const noexcept {
+        return std::this_thread::get_id() == thread_.get_id();
+    }
+
+private:
+    void run() {
+        std::vector<std::pair<std::function<void(int)>, int>> batch;
+        batch.reserve(1024);
+        while (!stopped_.load(std::memory_order_acquire)) {
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                batch.swap(queue_);
+            }
+            if (batch.empty()) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (auto& item : batch) {
+                item.first(item.second);
+            }
+            batch.clear();
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<std::pair<std::function<void(int)>, int>> queue_;
+    std::atomic_bool stopped_{false};
+    std::thread thread_;
+};
+
+struct callee final {
+    worker* home;
+    worker* remote;
+
+    void operator()(int value, std::function<void(int)> callback) const {
+        if (!remote) {
+            callback(value);
+        } else if (remote->running_in_this_thread()) {
+            home->post(std::move(callback), value);
+        } else {
+            remote->post(std::move(callback), value);
+        }
+    }
+};
+
+struct topology final {
+    const char* name;
+    std::size_t producers;
+    bool remote;
+};
+
+struct producer final {
+    worker home;
+    samples_t samples;
+};
+
+template <typename _Op>
+auto blocking(_Op op) {
+    return [op](producer& self, callee target, std::size_t count, std::atomic<std::size_t>& running) {
+        self.home.post([op, &self, target, count, &running]() {
+            for (std::size_t i = 0; i < count; ++i) {
+                const auto begin = now_ns();
+                op(target, static_cast<int>(i));
+                self.samples.push_back(now_ns() - begin);
+            }
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    };
+}
+
+template <typename _Make>
+void chain(_Make make, producer* self, callee target, std::size_t index, std::size_t count,
+           std::atomic<std::size_t>* running) {
+    for (; index < count; ++index) {
+        const auto begin = now_ns();
+        auto future = make(self, target, static_cast<int>(index));
+        if (!future.ready()) {
+            std::move(future).then([make, self, target, index, count, running, begin](int) {
+                self->samples.push_back(now_ns() - begin);
+                chain(make, self, target, index + 1, count, running);
+            });
+            return;
+        }
+        future.get();
+        self->samples.push_back(now_ns() - begin);
+    }
+    running->fetch_sub(1, std::memory_order_release);
+}
+
+template <typename _Make>
+auto chaining(_Make make) {
+    return [make](producer& self, callee target, std::size_t count, std::atomic<std::size_t>& running) {
+        self.home.post([make, &self, target, count, &running]() { chain(make, &self, target, 0, count, &running); });
+    };
+}
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Make>
+awaitable drive(_Make make, producer* self, callee target, std::size_t count, std::atomic<std::size_t>* running) {
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto begin = now_ns();
+        co_await make(self, target, static_cast<int>(i));
+        self->samples.push_back(now_ns() - begin);
+    }
+    running->fetch_sub(1, std::memory_order_release);
+}
+
+template <typename _Make>
+auto awaiting(_Make make) {
+    return [make](producer& self, callee target, std::size_t count, std::atomic<std::size_t>& running) {
+        self.home.post([make, &self, target, count, &running]() { drive(make, &self, target, count, &running); });
+    };
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+std::int64_t percentile(samples_t& samples, double p) {
+    const auto n = static_cast<std::size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return samples[n];
+}
+
+template <typename _Start>
+void measure(const char* mode, const topology& shape, std::size_t count, _Start start) {
+    std::unique_ptr<worker> completer{shape.remote ? new worker{} : nullptr};
+    std::vector<std::unique_ptr<producer>> producers;
+    for (std::size_t i = 0; i < shape.producers; ++i) {
+        producers.emplace_back(new producer{});
+        producers.back()->samples.reserve(count);
+    }
+    std::atomic<std::size_t> running{shape.producers};
+
+    const auto allocations = g_allocations.load();
+    const auto begin = now_ns();
+    for (auto& self : producers) {
+        start(*self, callee{&self->home, completer.get()}, count, running);
+    }
+    while (running.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+    const auto elapsed = now_ns() - begin;
+    const auto calls = count * shape.producers;
+    const auto allocs = static_cast<double>(g_allocations.load() - allocations) / calls;
+
+    samples_t samples;
+    samples.reserve(calls);
+    for (auto& self : producers) {
+        samples.insert(samples.end(), self->samples.begin(), self->samples.end());
+    }
+    std::printf("%-30s %-14s %12.0f %9.2f %9.2f %9.2f %9.2f\n", mode, shape.name, calls * 1e9 / elapsed,
+                percentile(samples, 0.5) / 1e3, percentile(samples, 0.99) / 1e3, percentile(samples, 0.999) / 1e3,
+                allocs);
+}
+
+} // namespace
+
+// every form of new and delete is replaced, on malloc and free. gcc still reports free on a pointer from
+// operator new once both are inlined into one caller, which is what these replacements mean to do.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+int main(int argc, char** argv) {
+    const std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    const std::size_t fan_in = std::max<std::size_t>(2, std::min<std::size_t>(4, std::thread::hardware_concurrency()));
+    const topology topologies[]{
+        {"inline", 1, false},
+        {"cross-thread", 1, true},
+        {"fan-in", fan_in, true},
+    };
+
+    std::printf("%-30s %-14s %12s %9s %9s %9s %9s\n", "mode", "completion", "calls/s", "p50 us", "p99 us", "p999 us",
+                "allocs");
+    for (const auto& shape : topologies) {
+        measure("raw callback", shape, count, blocking([](const callee& target, int i) {
+                    std::atomic_bool fired{false};
+                    target(i, [&fired](int) { fired.store(true, std::memory_order_release); });
+                    while (!fired.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                }));
+
+        measure("std_future", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(target, i, placeholder::std_future).get();
+                }));
+
+        measure("std_future recycling", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(std::allocator_arg, recycling_allocator<void>{}, target, i,
+                                  placeholder::std_future)
+                        .get();
+                }));
+
+        measure("std_future with_timeout", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(target, i, placeholder::with_timeout(placeholder::std_future, std::chrono::seconds{1}))
+                        .get();
+                }));
+
+        measure("blocking", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(target, i, placeholder::blocking).get();
+                }));
+
+        measure("blocking spin 0", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(target, i, placeholder::blocking_spin(0)).get();
+                }));
+
+        measure("blocking recycling", shape, count, blocking([](const callee& target, int i) {
+                    async_wrapper(std::allocator_arg, recycling_allocator<void>{}, target, i, placeholder::blocking)
+                        .get();
+                }));
+
+        measure("continuable then", shape, count, chaining([](producer*, const callee& target, int i) {
+                    return async_wrapper(target, i, placeholder::continuable);
+                }));
+
+        measure("continuable then recycling", shape, count, chaining([](producer*, const callee& target, int i) {
+                    return async_wrapper(std::allocator_arg, recycling_allocator<void>{}, target, i,
+                                         placeholder::continuable);
+                }));
+
+        measure("continuable then(producer)", shape, count, chaining([](producer* self, const callee& target, int i) {
+                    return async_wrapper(target, i, placeholder::continuable).then(self->home, [](int v) { return v; });
+                }));
+
+#if defined(ENABLE_CO_AWAIT)
+        measure("awaitable", shape, count, awaiting([](producer*, const callee& target, int i) {
+                    return async_wrapper(target, i, placeholder::awaitable);
+                }));
+
+        measure("awaitable recycling", shape, count, awaiting([](producer*, const callee& target, int i) {
+                    return async_wrapper(std::allocator_arg, recycling_allocator<void>{}, target, i,
+                                         placeholder::awaitable);
+                }));
+
+        measure("awaitable deferred", shape, count, awaiting([](producer*, const callee& target, int i) {
+                    return async_wrapper(target, i, placeholder::deferred);
+                }));
+
+        measure("awaitable_on producer", shape, count, awaiting([](producer* self, const callee& target, int i) {
+                    return async_wrapper(target, i, placeholder::awaitable_on(self->home, placeholder::inline_if_running));
+                }));
+
+        measure("sync_wait awaitable_on(loop)", shape, count, blocking([](const callee& target, int i) {
+                    static thread_local run_loop loop;
+                    sync_wait(loop, async_wrapper(target, i, placeholder::awaitable_on(loop)));
+                }));
+
+        measure("awaitable with_timeout", shape, count, awaiting([](producer*, const callee& target, int i) {
+                    return async_wrapper(target, i,
+                                         placeholder::with_timeout(placeholder::awaitable, std::chrono::seconds{1}));
+                }));
+#endif // defined(ENABLE_CO_AWAIT)
+    }
+
+#if defined(ENABLE_INSTRUMENTATION)
+    instrumentation::write_summary(std::cout);
+#endif // defined(ENABLE_INSTRUMENTATION)
+
+    return 0;
+}
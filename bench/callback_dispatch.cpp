@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// 比较std::function回调、模板回调（不做类型擦除）与C函数指针回调每次完成的开销
+// g++ -std=c++14 -O2 -I.. callback_dispatch.cpp -pthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#include <async_wrapper.hpp>
+
+namespace {
+
+std::atomic<std::size_t> g_allocations{0};
+
+void erased_callee(int a, std::function<void(int)> f) {
+    f(a);
+}
+
+void c_callee(int a, void (*callback)(void*, int), void* user) {
+    callback(user, a);
+}
+
+struct generic_callee {
+    template <typename _Handler>
+    void operator()(int a, _Handler&& handler) const {
+        handler(a);
+    }
+};
+
+template <typename _Func>
+void run(const char* name, std::size_t count, _Func&& func) {
+    const auto allocations = g_allocations.load();
+    const auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+        func(static_cast<int>(i));
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    std::printf("%-40s %8.2f allocs/call %8.1f ns/call\n", name,
+                static_cast<double>(g_allocations.load() - allocations) / count, static_cast<double>(ns) / count);
+}
+
+} // namespace
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+int main() {
+    using namespace cue;
+    constexpr std::size_t count{5000000};
+    const recycling_allocator<void> allocator;
+
+    run("std_future std::function", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, erased_callee, i, placeholder::std_future).get();
+    });
+
+    run("std_future handler", count, [&](int i) {
+        async_wrapper<void(int)>(std::allocator_arg, allocator, generic_callee{}, i, placeholder::std_future).get();
+    });
+
+    run("std_future C callback", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, c_callee, i, placeholder::std_future, placeholder::user_data)
+            .get();
+    });
+
+    run("continuable std::function", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, erased_callee, i, placeholder::continuable).get();
+    });
+
+    run("continuable C callback", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, c_callee, i, placeholder::continuable, placeholder::user_data)
+            .get();
+    });
+
+#if defined(ENABLE_CO_AWAIT)
+    run("awaitable std::function", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, erased_callee, i, placeholder::awaitable);
+    });
+
+    run("awaitable handler", count, [&](int i) {
+        async_wrapper<void(int)>(std::allocator_arg, allocator, generic_callee{}, i, placeholder::awaitable);
+    });
+
+    run("awaitable C callback", count, [&](int i) {
+        async_wrapper(std::allocator_arg, allocator, c_callee, i, placeholder::awaitable, placeholder::user_data);
+    });
+#endif // defined(ENABLE_CO_AWAIT)
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// 百万层互相等待的awaitable协程、百万次同步完成的循环、百万个排队的限流调用依次交接许可，各自的耗时与占用的栈深度
+// g++ -std=c++20 -O2 -DENABLE_CO_AWAIT -I.. coroutine_depth.cpp -pthread && ./a.out [depth]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <async_wrapper.hpp>
+
+using namespace cue;
+
+namespace {
+
+#if defined(ENABLE_CO_AWAIT)
+std::uintptr_t g_stack_base{0};
+std::uintptr_t g_stack_low{0};
+
+void sample_stack() {
+    char here;
+    g_stack_low = std::min(g_stack_low, reinterpret_cast<std::uintptr_t>(&here));
+}
+
+std::deque<std::function<void(int)>> g_queue;
+
+void queued_callee(int value, std::function<void(int)> callback) {
+    g_queue.emplace_back(std::move(callback));
+    (void)value;
+}
+
+void inline_callee(int value, std::function<void(int)> callback) {
+    callback(value + 1);
+}
+
+void drain() {
+    while (!g_queue.empty()) {
+        auto callback = std::move(g_queue.front());
+        g_queue.pop_front();
+        callback(1);
+    }
+}
+
+awaitable_t<std::size_t> nested(std::size_t depth) {
+    co_await async_wrapper(queued_callee, 0, placeholder::awaitable);
+    if (!depth) {
+        co_return 0;
+    }
+    const auto result = co_await nested(depth - 1);
+    sample_stack();
+    co_return result + 1;
+}
+
+awaitable_t<int> inline_child(int value) {
+    co_return co_await async_wrapper(inline_callee, value, placeholder::awaitable);
+}
+
+awaitable_t<int> queued_child() {
+    co_return co_await async_wrapper(queued_callee, 0, placeholder::awaitable);
+}
+
+awaitable_t<std::size_t> loop(std::size_t count, bool through_queue) {
+    std::size_t sum{0};
+    for (std::size_t i = 0; i < count; ++i) {
+        sum += through_queue ? co_await queued_child() : co_await inline_child(0);
+        sample_stack();
+    }
+    co_return sum;
+}
+
+awaitable_t<int> limited_call(async_semaphore& semaphore) {
+    const auto result = co_await async_wrapper(inline_callee, 0, placeholder::limited(semaphore, placeholder::deferred));
+    sample_stack();
+    co_return result;
+}
+
+awaitable_t<std::size_t> handoff(std::size_t count) {
+    async_semaphore semaphore{1};
+    semaphore.try_acquire();
+    std::vector<awaitable_t<int>> waiters;
+    waiters.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        waiters.push_back(limited_call(semaphore));
+    }
+    semaphore.release();
+    std::size_t sum{0};
+    for (auto& waiter : waiters) {
+        sum += static_cast<std::size_t>(co_await waiter);
+    }
+    co_return sum;
+}
+
+template <typename _Start>
+void run(const char* name, std::size_t count, _Start start) {
+    char base;
+    g_stack_base = reinterpret_cast<std::uintptr_t>(&base);
+    g_stack_low = g_stack_base;
+    const auto begin = std::chrono::steady_clock::now();
+    auto future = start();
+    drain();
+    const auto result = future.get();
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::printf("%-30s %10zu %12.1f %14zu\n", name, result, count / seconds / 1e6,
+                static_cast<std::size_t>(g_stack_base - g_stack_low));
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace
+
+int main(int argc, char** argv) {
+#if defined(ENABLE_CO_AWAIT)
+    const std::size_t depth = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    std::printf("%-30s %10s %12s %14s\n", "case", "result", "M awaits/s", "stack bytes");
+    run("nested awaitable chain", depth, [depth]() { return nested(depth); });
+    run("loop of inline completions", depth, [depth]() { return loop(depth, false); });
+    run("loop of queued completions", depth, [depth]() { return loop(depth, true); });
+    run("semaphore handoff chain", depth, [depth]() { return handoff(depth); });
+#else
+    (void)argc;
+    (void)argv;
+    std::printf("build with ENABLE_CO_AWAIT\n");
+#endif // defined(ENABLE_CO_AWAIT)
+    return 0;
+}
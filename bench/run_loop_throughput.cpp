@@ -0,0 +1,101 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// run_loop上每秒执行的跨线程投递，以及sync_wait驱动的协程在run_loop上每秒恢复的次数
+// g++ -std=c++20 -O2 -DENABLE_CO_AWAIT -I.. run_loop_throughput.cpp -pthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <run_loop.hpp>
+
+using namespace cue;
+
+namespace {
+
+void run_posts(const char* name, std::size_t producers, std::size_t count) {
+    run_loop loop;
+    std::size_t done{0};
+    const auto total = producers * count;
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < producers; ++i) {
+        threads.emplace_back([&loop, &done, total, count]() {
+            for (std::size_t n = 0; n < count; ++n) {
+                loop.post([&loop, &done, total]() {
+                    if (++done == total) {
+                        loop.stop();
+                    }
+                });
+            }
+        });
+    }
+    loop.run();
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::printf("%-40s %10.0f posts/s\n", name, total / seconds);
+}
+
+#if defined(ENABLE_CO_AWAIT)
+void async_increase(thread_pool* pool, int value, std::function<void(int)> callback) {
+    pool->post([value, callback]() { callback(value + 1); });
+}
+
+template <typename _Placeholder>
+awaitable_t<int> chain(thread_pool* pool, int count, _Placeholder placeholder) {
+    int value{0};
+    for (int i = 0; i < count; ++i) {
+        value = co_await async_wrapper(async_increase, pool, value, placeholder);
+    }
+    co_return value;
+}
+
+void run_chains(const char* name, thread_pool& pool, std::size_t coroutines, int count) {
+    run_loop loop;
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<awaitable_t<int>> chains;
+    chains.reserve(coroutines);
+    loop.post([&]() {
+        for (std::size_t i = 0; i < coroutines; ++i) {
+            chains.push_back(chain(&pool, count, placeholder::awaitable_on(loop)));
+        }
+    });
+    loop.poll();
+    sync_wait(loop, when_all(std::move(chains)));
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::printf("%-40s %10.0f resumes/s\n", name, coroutines * count / seconds);
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace
+
+int main() {
+    run_posts("post, 1 producer", 1, 1000000);
+    run_posts("post, 4 producers", 4, 250000);
+#if defined(ENABLE_CO_AWAIT)
+    thread_pool pool;
+    run_chains("sync_wait awaitable_on(loop)", pool, 64, 20000);
+#endif // defined(ENABLE_CO_AWAIT)
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// thread_pool上每秒恢复awaitable_future的次数
+// g++ -std=c++20 -O2 -DENABLE_CO_AWAIT -I.. thread_pool_throughput.cpp -pthread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <thread_pool.hpp>
+
+using namespace cue;
+
+namespace {
+
+void async_increase(thread_pool* pool, int value, std::function<void(int)> callback) {
+    pool->post([value, callback]() { callback(value + 1); });
+}
+
+std::atomic<std::size_t> g_running{0};
+
+#if defined(ENABLE_CO_AWAIT)
+template <typename _Placeholder>
+awaitable chain(thread_pool* pool, int count, _Placeholder placeholder) {
+    int value{0};
+    for (int i = 0; i < count; ++i) {
+        value = co_await async_wrapper(async_increase, pool, value, placeholder);
+    }
+    if (value == count) {
+        g_running.fetch_sub(1);
+    }
+}
+
+template <typename _Placeholder>
+void run(const char* name, thread_pool& pool, std::size_t coroutines, int count, _Placeholder placeholder) {
+    g_running = coroutines;
+    const auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < coroutines; ++i) {
+        pool.post([&pool, count, placeholder]() { chain(&pool, count, placeholder); });
+    }
+    while (g_running.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::printf("%-40s %10.0f resumes/s\n", name, coroutines * count / seconds);
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace
+
+int main() {
+#if defined(ENABLE_CO_AWAIT)
+    thread_pool pool;
+    constexpr std::size_t coroutines{64};
+    constexpr int count{50000};
+    std::printf("%zu workers\n", pool.size());
+    run("awaitable (resume on callback thread)", pool, coroutines, count, placeholder::awaitable);
+    run("awaitable_on(pool)", pool, coroutines, count, placeholder::awaitable_on(pool));
+    run("awaitable_on(pool, inline_if_running)", pool, coroutines, count,
+        placeholder::awaitable_on(pool, placeholder::inline_if_running));
+#else
+    std::printf("build with ENABLE_CO_AWAIT\n");
+#endif // defined(ENABLE_CO_AWAIT)
+    return 0;
+}
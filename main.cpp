@@ -21,6 +21,7 @@
 #include <thread>
 
 #include <async_wrapper.hpp>
+#include <run_loop.hpp>
 
 using namespace cue;
 
@@ -64,22 +65,23 @@ int main(int argc, char** argv) {
     std::cout << std::get<0>(r3r) << " " << std::get<1>(r3r) << std::endl;
 
 #if defined(ENABLE_CO_AWAIT)
-    []() -> awaitable {
+    // 在当前线程上运行事件循环直到协程结束
+    run_loop loop;
+    sync_wait(loop, []() -> awaitable {
         auto r4 = co_await async_wrapper(func1, 1, 2, placeholder::awaitable, 1.0);
         static_assert(std::is_same<decltype(r4), int>{}, "");
         std::cout << r4 << std::endl;
-    }();
+    }());
 
-    []() -> awaitable { co_await async_wrapper(func2, 1, 2, placeholder::awaitable); }();
+    sync_wait(loop, async_wrapper(func2, 1, 2, placeholder::awaitable));
 
-    []() -> awaitable {
-        auto r6 = co_await async_wrapper(func3, 1, 2, placeholder::awaitable);
+    // 回调线程只投递恢复，协程在loop所在的线程上继续
+    sync_wait(loop, [&loop]() -> awaitable {
+        auto r6 = co_await async_wrapper(func3, 1, 2, placeholder::awaitable_on(loop));
         static_assert(std::is_same<decltype(r6), std::tuple<int, int>>{}, "");
         std::cout << std::get<0>(r6) << " " << std::get<1>(r6) << std::endl;
-    }();
+    }());
 #endif // defined(ENABLE_CO_AWAIT)
 
-    getchar();
-
     return 0;
 }
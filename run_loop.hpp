@@ -0,0 +1,385 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef RUN_LOOP_HPP_
+#define RUN_LOOP_HPP_
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "thread_pool.hpp"
+
+namespace cue {
+
+namespace detail {
+
+struct run_loop_access;
+
+} // namespace detail
+
+// single threaded event loop on epoll, usable as executor for placeholder::awaitable_on
+class run_loop final {
+public:
+    run_loop() : epoll_{::epoll_create1(EPOLL_CLOEXEC)}, event_{::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)} {
+        if (epoll_ < 0 || event_ < 0) {
+            const auto error = errno;
+            close();
+            throw std::system_error{error, std::system_category(), "run_loop"};
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, event_, &event) < 0) {
+            const auto error = errno;
+            close();
+            throw std::system_error{error, std::system_category(), "run_loop"};
+        }
+    }
+
+    run_loop(const run_loop&) = delete;
+    run_loop& operator=(const run_loop&) = delete;
+
+    ~run_loop() {
+        while (run_posted()) {
+        }
+        close();
+    }
+
+    template <typename _Func>
+    void post(_Func&& func) {
+        using task_t = detail::pool_task_impl<std::decay_t<_Func>>;
+        push(reinterpret_cast<detail::pool_item>(task_t::create(std::forward<_Func>(func))) | 1);
+    }
+
+#if defined(ENABLE_CO_AWAIT)
+    void post(std::coroutine_handle<> handle) {
+        push(reinterpret_cast<detail::pool_item>(handle.address()));
+    }
+#endif // defined(ENABLE_CO_AWAIT)
+
+    bool running_in_this_thread() const noexcept {
+        return current() == this;
+    }
+
+    void run() {
+        scope running{this};
+        while (!stopped_.load(std::memory_order_acquire)) {
+            run_round(true);
+        }
+        stopped_.store(false, std::memory_order_relaxed);
+    }
+
+    std::size_t poll() {
+        std::size_t count;
+        {
+            scope running{this};
+            count = run_round(false);
+        }
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!remote_.empty() || !local_.empty()) {
+            wake();
+        }
+        return count;
+    }
+
+    void stop() noexcept {
+        stopped_.store(true, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake();
+    }
+
+    void watch(int fd, std::uint32_t events, std::function<void(std::uint32_t)> handler) {
+        std::unique_ptr<watcher> entry{new watcher{std::move(handler), false}};
+        epoll_event event{};
+        event.events = events;
+        event.data.ptr = entry.get();
+        if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::system_error{errno, std::system_category(), "run_loop::watch"};
+        }
+        watchers_[fd] = std::move(entry);
+    }
+
+    void unwatch(int fd) {
+        auto it = watchers_.find(fd);
+        if (it == watchers_.end()) {
+            return;
+        }
+        ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+        it->second->removed = true;
+        retired_.push_back(std::move(it->second));
+        watchers_.erase(it);
+    }
+
+    int native_handle() const noexcept {
+        return epoll_;
+    }
+
+private:
+    friend struct detail::run_loop_access;
+
+    struct watcher final {
+        std::function<void(std::uint32_t)> handler;
+        bool removed;
+    };
+
+    class scope final {
+    public:
+        explicit scope(const run_loop* loop) noexcept : outer_{current()} {
+            current() = loop;
+        }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope() {
+            current() = outer_;
+        }
+
+    private:
+        const run_loop* outer_;
+    };
+
+    static const run_loop*& current() noexcept {
+        static thread_local const run_loop* loop{nullptr};
+        return loop;
+    }
+
+    void push(detail::pool_item item) {
+        if (running_in_this_thread()) {
+            local_.push_back(item);
+            return;
+        }
+        auto node = recycling_allocator<detail::post_node>{}.allocate(1);
+        node->item = item;
+        if (remote_.push(node)) {
+            // pairs with the fence in run_round(), either we see the sleeper or it sees the node
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake();
+        }
+    }
+
+    void wake() noexcept {
+        if (sleeping_.exchange(false, std::memory_order_relaxed)) {
+            const std::uint64_t one{1};
+            while (::write(event_, &one, sizeof(one)) < 0 && errno == EINTR) {
+            }
+        }
+    }
+
+    std::size_t run_posted() {
+        std::size_t count{0};
+        auto batch = std::move(spare_);
+        batch.clear();
+        batch.swap(local_);
+        for (auto item : batch) {
+            detail::run_pool_item(item);
+            ++count;
+        }
+        batch.clear();
+        spare_ = std::move(batch);
+
+        auto node = remote_.take();
+        while (node) {
+            const auto item = node->item;
+            auto next = node->next;
+            recycling_allocator<detail::post_node>{}.deallocate(node, 1);
+            node = next;
+            detail::run_pool_item(item);
+            ++count;
+        }
+        return count;
+    }
+
+    std::size_t run_round(bool may_sleep) {
+        auto count = run_posted();
+        int timeout{0};
+        if (!count && may_sleep) {
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (remote_.empty() && local_.empty() && !stopped_.load(std::memory_order_relaxed)) {
+                timeout = -1;
+            }
+        } else if (may_sleep && watchers_.empty()) {
+            return count;
+        }
+
+        epoll_event events[64];
+        const auto ready = ::epoll_wait(epoll_, events, 64, timeout);
+        sleeping_.store(false, std::memory_order_relaxed);
+        for (int i = 0; i < ready; ++i) {
+            auto entry = static_cast<watcher*>(events[i].data.ptr);
+            if (!entry) {
+                std::uint64_t value;
+                while (::read(event_, &value, sizeof(value)) < 0 && errno == EINTR) {
+                }
+            } else if (!entry->removed) {
+                entry->handler(events[i].events);
+                ++count;
+            }
+        }
+        retired_.clear();
+        return count;
+    }
+
+    void close() noexcept {
+        if (event_ >= 0) {
+            ::close(event_);
+        }
+        if (epoll_ >= 0) {
+            ::close(epoll_);
+        }
+    }
+
+    int epoll_;
+    int event_;
+    detail::post_queue remote_;
+    std::atomic_bool sleeping_{false};
+    std::atomic_bool stopped_{false};
+    std::vector<detail::pool_item> local_;
+    std::vector<detail::pool_item> spare_;
+    std::unordered_map<int, std::unique_ptr<watcher>> watchers_;
+    std::vector<std::unique_ptr<watcher>> retired_;
+};
+
+#if defined(ENABLE_CO_AWAIT)
+namespace detail {
+
+struct run_loop_access final {
+    template <typename _Start>
+    static void run_until(run_loop& loop, _Start&& start, const bool& done) {
+        run_loop::scope running{&loop};
+        start();
+        while (!done) {
+            loop.run_round(true);
+        }
+    }
+};
+
+class resume_on_loop final {
+public:
+    resume_on_loop(run_loop& loop, std::atomic_int& posting) noexcept : loop_{loop}, posting_{posting} {
+    }
+
+    bool await_ready() const noexcept {
+        return loop_.running_in_this_thread();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        posting_.fetch_add(1, std::memory_order_relaxed);
+        loop_.post(handle);
+        posting_.fetch_sub(1, std::memory_order_release);
+    }
+
+    void await_resume() const noexcept {
+    }
+
+private:
+    run_loop& loop_;
+    std::atomic_int& posting_;
+};
+
+template <typename _Awaitable>
+auto get_awaiter(_Awaitable&& awaitable, int) -> decltype(std::forward<_Awaitable>(awaitable).operator co_await()) {
+    return std::forward<_Awaitable>(awaitable).operator co_await();
+}
+
+template <typename _Awaitable>
+_Awaitable&& get_awaiter(_Awaitable&& awaitable, long) {
+    return std::forward<_Awaitable>(awaitable);
+}
+
+template <typename _Awaitable>
+using await_result_t = decltype(get_awaiter(std::declval<_Awaitable>(), 0).await_resume());
+
+template <typename _Ty>
+struct sync_wait_state final {
+    inline_result<_Ty> result;
+    std::exception_ptr exception{nullptr};
+    std::atomic_int posting{0};
+    bool done{false};
+};
+
+template <typename _Ty, typename _Awaitable>
+awaitable sync_wait_drive(run_loop& loop, sync_wait_state<_Ty>& state, _Awaitable&& awaitable, std::false_type) {
+    try {
+        auto&& value = co_await std::forward<_Awaitable>(awaitable);
+        co_await resume_on_loop{loop, state.posting};
+        state.result.emplace(std::forward<decltype(value)>(value));
+    } catch (...) {
+        state.exception = std::current_exception();
+    }
+    co_await resume_on_loop{loop, state.posting};
+    state.done = true;
+}
+
+template <typename _Ty, typename _Awaitable>
+awaitable sync_wait_drive(run_loop& loop, sync_wait_state<_Ty>& state, _Awaitable&& awaitable, std::true_type) {
+    try {
+        co_await std::forward<_Awaitable>(awaitable);
+    } catch (...) {
+        state.exception = std::current_exception();
+    }
+    co_await resume_on_loop{loop, state.posting};
+    state.done = true;
+}
+
+} // namespace detail
+
+// runs loop on the calling thread until awaitable completed, stop() does not end the wait
+template <typename _Awaitable>
+auto sync_wait(run_loop& loop, _Awaitable&& awaitable) -> detail::await_result_t<_Awaitable> {
+    using result_t = detail::await_result_t<_Awaitable>;
+    detail::sync_wait_state<result_t> state;
+    detail::run_loop_access::run_until(
+        loop,
+        [&]() { detail::sync_wait_drive(loop, state, std::forward<_Awaitable>(awaitable), std::is_void<result_t>{}); },
+        state.done);
+    // a thread that posted the driver back may still be waking the loop, which the caller may destroy next
+    while (state.posting.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    if (state.exception) {
+        std::rethrow_exception(state.exception);
+    }
+    return state.result.take();
+}
+
+template <typename _Awaitable>
+auto sync_wait(_Awaitable&& awaitable) -> detail::await_result_t<_Awaitable> {
+    run_loop loop;
+    return sync_wait(loop, std::forward<_Awaitable>(awaitable));
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace cue
+
+#endif // RUN_LOOP_HPP_
@@ -0,0 +1,287 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef SINGLE_FLIGHT_HPP_
+#define SINGLE_FLIGHT_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "async_wrapper.hpp"
+
+namespace cue {
+
+namespace detail {
+
+template <typename _Tuple, std::size_t _Skip,
+          typename _Indexes = std::make_index_sequence<std::tuple_size<_Tuple>{} - 1>>
+struct tuple_without;
+
+template <typename... _Args, std::size_t _Skip, std::size_t... _Indexes>
+struct tuple_without<std::tuple<_Args...>, _Skip, std::index_sequence<_Indexes...>> {
+    using type = std::tuple<typename std::tuple_element<skip_index<_Indexes, _Skip>{}, std::tuple<_Args...>>::type...>;
+};
+
+template <typename _Callback>
+struct callback_values;
+
+template <typename _Ret, typename... _Args>
+struct callback_values<std::function<_Ret(_Args...)>> {
+    using type = std::tuple<std::decay_t<_Args>...>;
+};
+
+struct tuple_hash final {
+    template <typename... _Args>
+    std::size_t operator()(const std::tuple<_Args...>& key) const {
+        std::size_t seed{0};
+        index_apply<sizeof...(_Args)>([&](auto... _Indexes) {
+            (void)std::initializer_list<int>{(combine(seed, std::get<_Indexes>(key)), 0)...};
+            return 0;
+        });
+        return seed;
+    }
+
+    template <typename _Ty>
+    static void combine(std::size_t& seed, const _Ty& value) {
+        seed ^= std::hash<_Ty>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+};
+
+} // namespace detail
+
+struct single_flight_options final {
+    std::size_t shards{16};
+    // zero disables the cache
+    std::chrono::steady_clock::duration ttl{};
+    std::size_t capacity{1024};
+};
+
+// coalesces concurrent calls of func with equal arguments, the single_flight must outlive the calls in flight
+template <typename _Func>
+class single_flight final {
+    using args_t = detail::function_args<_Func>;
+    using args_tuple = typename args_t::args_tuple;
+    static constexpr std::size_t callback_index{detail::callback_index<args_t>{}};
+    static_assert(callback_index < args_t::arity, "no std::function parameter for the callback");
+
+    using callback_t = typename args_t::template arg_t<callback_index>;
+
+public:
+    using key_type = typename detail::tuple_without<args_tuple, callback_index>::type;
+    using values_type = typename detail::callback_values<callback_t>::type;
+
+    explicit single_flight(_Func func, const single_flight_options& options = single_flight_options{})
+        : func_{std::move(func)},
+          ttl_{options.ttl},
+          shard_capacity_{std::max<std::size_t>(1, options.capacity / std::max<std::size_t>(1, options.shards))},
+          shards_(std::max<std::size_t>(1, options.shards)) {
+    }
+
+    single_flight(single_flight&&) = default;
+    single_flight(const single_flight&) = delete;
+    single_flight& operator=(const single_flight&) = delete;
+
+    template <typename... _Args>
+    auto operator()(_Args&&... args) {
+        constexpr std::size_t index = detail::placeholder_index<std::tuple<std::decay_t<_Args>...>>{};
+        static_assert(index == callback_index, "the placeholder goes where func takes its callback");
+        static_assert(!detail::is_deferred_call<_Args...>{}, "placeholder::deferred is not supported");
+        auto completion = detail::make_completion<callback_t>(std::allocator<void>{},
+                                                              std::get<index>(std::forward_as_tuple(args...)));
+        auto future = std::move(completion.second);
+        using state_t = std::remove_pointer_t<decltype(completion.first)>;
+        join(make_key(std::forward_as_tuple(args...)), waiter{&complete<state_t>, completion.first},
+             std::forward<_Args>(args)...);
+        return future;
+    }
+
+private:
+    struct waiter final {
+        void (*complete)(void* state, const values_type* values, const std::exception_ptr& exception);
+        void* state;
+    };
+
+    // lands once: by the first callback, by func throwing or by the last copy of the callback dropped
+    struct flight final {
+        flight* promise() noexcept {
+            return this;
+        }
+
+        void add_callback() noexcept {
+            refs.fetch_add(1, std::memory_order_relaxed);
+            callbacks.copy();
+        }
+
+        bool claim_callback() noexcept {
+            return callbacks.fire();
+        }
+
+        void drop_callback() noexcept {
+            if (callbacks.drop()) {
+                owner->land(this, nullptr, detail::broken_promise());
+            }
+            if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+
+        template <typename... _Values>
+        void emplace_value(_Values&&... values) {
+            const values_type result{std::forward<_Values>(values)...};
+            owner->land(this, &result, nullptr);
+        }
+
+        single_flight* owner;
+        std::size_t shard;
+        key_type key;
+        std::vector<waiter> waiters;
+        std::atomic_int refs;
+        detail::callback_tally callbacks;
+    };
+
+    struct cached final {
+        key_type key;
+        values_type values;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    struct shard final {
+        std::mutex mutex;
+        std::unordered_map<key_type, flight*, detail::tuple_hash> flights;
+        std::list<cached> lru;
+        std::unordered_map<key_type, typename std::list<cached>::iterator, detail::tuple_hash> cache;
+    };
+
+    template <typename _State>
+    static void complete(void* state, const values_type* values, const std::exception_ptr& exception) {
+        auto self = static_cast<_State*>(state);
+        if (exception) {
+            if (self->claim_callback()) {
+                self->promise()->set_exception(exception);
+            }
+            self->drop_callback();
+        } else {
+            detail::apply(values_type{*values}, detail::make_handler(self));
+        }
+    }
+
+    template <typename _Tuple>
+    static key_type make_key(const _Tuple& args) {
+        return detail::index_apply<std::tuple_size<key_type>{}>([&](auto... _Indexes) {
+            return key_type{std::get<detail::skip_index<_Indexes, callback_index>{}>(args)...};
+        });
+    }
+
+    template <typename... _Args>
+    void join(key_type&& key, waiter caller, _Args&&... args) {
+        const auto index = detail::tuple_hash{}(key) % shards_.size();
+        auto& home = shards_[index];
+        std::unique_lock<std::mutex> lock{home.mutex};
+        if (ttl_.count()) {
+            auto hit = home.cache.find(key);
+            if (hit != home.cache.end()) {
+                if (hit->second->expiry > std::chrono::steady_clock::now()) {
+                    home.lru.splice(home.lru.begin(), home.lru, hit->second);
+                    const values_type values{hit->second->values};
+                    lock.unlock();
+                    caller.complete(caller.state, &values, nullptr);
+                    return;
+                }
+                home.lru.erase(hit->second);
+                home.cache.erase(hit);
+            }
+        }
+        auto joined = home.flights.find(key);
+        if (joined != home.flights.end()) {
+            joined->second->waiters.push_back(caller);
+            return;
+        }
+        std::unique_ptr<flight> call{new flight{this, index, key, {caller}, {1}, {}}};
+        home.flights.emplace(std::move(key), call.get());
+        lock.unlock();
+
+        const auto started = call.release();
+        const auto callback = detail::make_callee_callback<callback_t>(started, std::true_type{});
+        try {
+            detail::apply(std::make_tuple(detail::replace_placeholder(std::forward<_Args>(args), callback)...), func_);
+        } catch (...) {
+            if (started->claim_callback()) {
+                land(started, nullptr, std::current_exception());
+            }
+        }
+    }
+
+    void land(flight* call, const values_type* values, std::exception_ptr exception) {
+        auto& home = shards_[call->shard];
+        {
+            std::lock_guard<std::mutex> lock{home.mutex};
+            home.flights.erase(call->key);
+            if (values && ttl_.count()) {
+                store(home, call->key, *values);
+            }
+        }
+        for (auto& caller : call->waiters) {
+            caller.complete(caller.state, values, exception);
+        }
+    }
+
+    void store(shard& home, const key_type& key, const values_type& values) {
+        const auto expiry = std::chrono::steady_clock::now() + ttl_;
+        auto hit = home.cache.find(key);
+        if (hit != home.cache.end()) {
+            hit->second->values = values;
+            hit->second->expiry = expiry;
+            home.lru.splice(home.lru.begin(), home.lru, hit->second);
+            return;
+        }
+        if (home.cache.size() >= shard_capacity_) {
+            home.cache.erase(home.lru.back().key);
+            home.lru.pop_back();
+        }
+        home.lru.push_front(cached{key, values, expiry});
+        home.cache.emplace(key, home.lru.begin());
+    }
+
+    _Func func_;
+    const std::chrono::steady_clock::duration ttl_;
+    const std::size_t shard_capacity_;
+    std::vector<shard> shards_;
+};
+
+template <typename _Func>
+single_flight<std::decay_t<_Func>> make_single_flight(_Func&& func,
+                                                     const single_flight_options& options = single_flight_options{}) {
+    return single_flight<std::decay_t<_Func>>{std::forward<_Func>(func), options};
+}
+
+} // namespace cue
+
+#endif // SINGLE_FLIGHT_HPP_
@@ -0,0 +1,436 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// 各占位符的完成、异常与取消路径
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <async_wrapper.hpp>
+#include <run_loop.hpp>
+
+#include "test.hpp"
+
+using namespace cue;
+
+namespace {
+
+using held_t = test::held<void(int)>;
+using code_callee = std::function<void(std::function<void(std::error_code, int)>)>;
+
+void echo(int a, std::function<void(int)> f) {
+    f(a);
+}
+
+void echo_later(int a, std::function<void(int)> f) {
+    std::thread{[=]() { f(a); }}.detach();
+}
+
+void hold(held_t* slot, std::function<void(int)> f) {
+    slot->callback = std::move(f);
+}
+
+void throwing(int, std::function<void(int)>) {
+    throw std::runtime_error{"callee"};
+}
+
+void dropping(int, std::function<void(int)>) {
+}
+
+void twice(int a, std::function<void(int)> f) {
+    f(a);
+    f(a + 1);
+}
+
+void fire_then_throw(int a, std::function<void(int)> f) {
+    f(a);
+    throw std::runtime_error{"callee"};
+}
+
+struct generic_dropping final {
+    template <typename _Handler>
+    void operator()(int, _Handler&&) const {
+    }
+};
+
+struct generic_twice final {
+    template <typename _Handler>
+    void operator()(int a, _Handler&& handler) const {
+        auto copy = handler;
+        copy(a);
+        handler(a + 1);
+    }
+};
+
+const auto broken = std::make_error_code(std::future_errc::broken_promise);
+
+void c_echo(int a, void (*callback)(void*, int), void* user) {
+    callback(user, a);
+}
+
+void read_code(int code, std::function<void(std::error_code, int)> f) {
+    f(code ? std::make_error_code(std::errc::io_error) : std::error_code{}, 7);
+}
+
+// counts the blocks it has handed out and not yet got back. not final, states derive from their allocator
+template <typename _Ty>
+struct counting_allocator {
+    using value_type = _Ty;
+
+    explicit counting_allocator(int* live) noexcept : live{live} {
+    }
+
+    template <typename _Other>
+    counting_allocator(const counting_allocator<_Other>& other) noexcept : live{other.live} {
+    }
+
+    _Ty* allocate(std::size_t n) {
+        ++*live;
+        return std::allocator<_Ty>{}.allocate(n);
+    }
+
+    void deallocate(_Ty* block, std::size_t n) noexcept {
+        --*live;
+        std::allocator<_Ty>{}.deallocate(block, n);
+    }
+
+    int* live;
+};
+
+template <typename _Ty, typename _Other>
+bool operator==(const counting_allocator<_Ty>& lhs, const counting_allocator<_Other>& rhs) noexcept {
+    return lhs.live == rhs.live;
+}
+
+template <typename _Ty, typename _Other>
+bool operator!=(const counting_allocator<_Ty>& lhs, const counting_allocator<_Other>& rhs) noexcept {
+    return !(lhs == rhs);
+}
+
+void test_std_future() {
+    CHECK(async_wrapper(echo, 1, placeholder::std_future).get() == 1);
+    CHECK(async_wrapper(echo_later, 2, placeholder::std_future).get() == 2);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::std_future), std::runtime_error);
+
+    held_t slot;
+    stop_source source;
+    auto future = async_wrapper(hold, &slot, placeholder::with_stop_token(placeholder::std_future, source.get_token()));
+    source.request_stop();
+    CHECK(test::error_of([&]() { future.get(); }) == std::errc::operation_canceled);
+    // arriving after the cancellation, dropped
+    slot.callback(1);
+
+    CHECK(test::error_of([]() { async_wrapper(dropping, 1, placeholder::std_future).get(); }) == broken);
+    auto dropped = async_wrapper(hold, &slot, placeholder::std_future);
+    slot.callback = nullptr;
+    CHECK(test::error_of([&]() { dropped.get(); }) == broken);
+    CHECK(async_wrapper(twice, 1, placeholder::std_future).get() == 1);
+    CHECK_THROWS(async_wrapper(fire_then_throw, 1, placeholder::std_future), std::runtime_error);
+    CHECK(test::error_of([]() { async_wrapper<void(int)>(generic_dropping{}, 1, placeholder::std_future).get(); }) ==
+          broken);
+    CHECK(async_wrapper<void(int)>(generic_twice{}, 1, placeholder::std_future).get() == 1);
+}
+
+void test_timeout() {
+    held_t slot;
+    const auto timeout = std::chrono::milliseconds{1};
+    auto future = async_wrapper(hold, &slot, placeholder::with_timeout(placeholder::std_future, timeout));
+    CHECK(test::error_of([&]() { future.get(); }) == std::errc::timed_out);
+    slot.callback(1);
+
+    // a call completed long before its deadline is freed at once, not once the wheel comes by
+    int live{0};
+    {
+        auto early = async_wrapper(std::allocator_arg, counting_allocator<void>{&live}, hold, &slot,
+                                   placeholder::with_timeout(placeholder::std_future, std::chrono::hours{1}));
+        slot.callback(2);
+        slot.callback = nullptr;
+        CHECK(early.get() == 2);
+    }
+    CHECK(live == 0);
+}
+
+void test_blocking() {
+    CHECK(async_wrapper(echo, 1, placeholder::blocking).get() == 1);
+    CHECK(async_wrapper(echo_later, 2, placeholder::blocking_spin(0)).get() == 2);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::blocking), std::runtime_error);
+
+    held_t slot;
+    const auto timeout = std::chrono::milliseconds{1};
+    auto future = async_wrapper(hold, &slot, placeholder::with_timeout(placeholder::blocking, timeout));
+    CHECK(test::error_of([&]() { future.get(); }) == std::errc::timed_out);
+    slot.callback(1);
+
+    CHECK(test::error_of([]() { async_wrapper(dropping, 1, placeholder::blocking).get(); }) == broken);
+    CHECK(async_wrapper(twice, 1, placeholder::blocking).get() == 1);
+}
+
+void test_continuable() {
+    CHECK(async_wrapper(echo, 1, placeholder::continuable).then([](int a) { return a + 1; }).get() == 2);
+    CHECK(async_wrapper(echo_later, 2, placeholder::continuable)
+              .then([](int a) { return async_wrapper(echo_later, a + 1, placeholder::continuable); })
+              .get() == 3);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::continuable), std::runtime_error);
+
+    held_t slot;
+    stop_source source;
+    auto future =
+        async_wrapper(hold, &slot, placeholder::with_stop_token(placeholder::continuable, source.get_token()))
+            .then([](int a) { return a; });
+    source.request_stop();
+    CHECK(test::error_of([&]() { future.get(); }) == std::errc::operation_canceled);
+    slot.callback(1);
+
+    auto dropped = async_wrapper(hold, &slot, placeholder::continuable).then([](int a) { return a; });
+    slot.callback = nullptr;
+    CHECK(test::error_of([&]() { dropped.get(); }) == broken);
+    CHECK(async_wrapper(twice, 1, placeholder::continuable).get() == 1);
+}
+
+void test_user_data() {
+    CHECK(async_wrapper(c_echo, 1, placeholder::std_future, placeholder::user_data).get() == 1);
+    CHECK(async_wrapper(c_echo, 2, placeholder::blocking, placeholder::user_data).get() == 2);
+}
+
+void test_as_expected() {
+    auto ok = async_wrapper(read_code, 0, placeholder::as_expected(placeholder::std_future)).get();
+    CHECK(ok && *ok == 7);
+    auto error = async_wrapper(read_code, 1, placeholder::as_expected(placeholder::std_future)).get();
+    CHECK(!error && error.error() == std::errc::io_error);
+
+    held_t slot;
+    auto hold_code = [&slot](std::function<void(std::error_code, int)> f) {
+        slot.callback = [f](int a) { f({}, a); };
+    };
+    const auto timed = placeholder::with_timeout(placeholder::as_expected(placeholder::std_future),
+                                                 std::chrono::milliseconds{1});
+    auto timed_out = async_wrapper(code_callee{hold_code}, timed).get();
+    CHECK(!timed_out && timed_out.error() == std::errc::timed_out);
+    slot.callback(1);
+
+    auto dropping_code = [](std::function<void(std::error_code, int)>) {};
+    CHECK(test::error_of([&]() {
+              async_wrapper(code_callee{dropping_code}, placeholder::as_expected(placeholder::std_future)).get();
+          }) == broken);
+}
+
+void test_limited() {
+    async_semaphore limit{1};
+    held_t slot;
+    auto first = async_wrapper(hold, &slot, placeholder::limited(limit, placeholder::continuable));
+    // waits for the permit of the first
+    auto second = async_wrapper(echo, 2, placeholder::limited(limit, placeholder::continuable));
+    CHECK(!second.ready());
+    slot.callback(1);
+    CHECK(first.get() == 1);
+    CHECK(second.get() == 2);
+    CHECK(async_wrapper(echo_later, 3, placeholder::limited(limit, placeholder::std_future)).get() == 3);
+
+    // a dropped callback returns the permit too
+    CHECK(test::error_of([&]() {
+              async_wrapper(dropping, 1, placeholder::limited(limit, placeholder::std_future)).get();
+          }) == broken);
+    CHECK(async_wrapper(echo, 4, placeholder::limited(limit, placeholder::continuable)).get() == 4);
+
+    // a throwing callee returns it as well, started right away or once the permit was handed over
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::limited(limit, placeholder::std_future)), std::runtime_error);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::limited(limit, placeholder::continuable)), std::runtime_error);
+    auto holding = async_wrapper(hold, &slot, placeholder::limited(limit, placeholder::continuable));
+    auto queued = async_wrapper(throwing, 1, placeholder::limited(limit, placeholder::continuable));
+    slot.callback(5);
+    CHECK(holding.get() == 5);
+    CHECK_THROWS(queued.get(), std::runtime_error);
+    CHECK(limit.try_acquire());
+}
+
+void test_bulk() {
+    const std::vector<std::tuple<int>> keys{std::make_tuple(1), std::make_tuple(2), std::make_tuple(3)};
+    auto some = [](int a, std::function<void(int)> f) {
+        if (a != 2) {
+            f(a);
+        }
+    };
+    auto future = async_wrapper_bulk(some, keys, placeholder::std_future);
+    future.wait();
+    CHECK(future.get(0) == 1);
+    CHECK(test::error_of([&]() { future.get(1); }) == broken);
+    CHECK(future.get(2) == 3);
+
+    auto failing = [](int a, std::function<void(int)> f) {
+        if (a == 2) {
+            throw std::runtime_error{"callee"};
+        }
+        f(a);
+    };
+    CHECK_THROWS(async_wrapper_bulk(failing, keys, placeholder::std_future), std::runtime_error);
+}
+
+#if defined(ENABLE_CO_AWAIT)
+// records for each copy or move whether it ran on the loop's thread
+struct located final {
+    located() = default;
+
+    located(const located& other) : moves{other.moves} {
+        moves.push_back(loop && loop->running_in_this_thread());
+    }
+
+    located(located&& other) noexcept : moves{std::move(other.moves)} {
+        moves.push_back(loop && loop->running_in_this_thread());
+    }
+
+    static run_loop* loop;
+    std::vector<bool> moves;
+};
+
+run_loop* located::loop{nullptr};
+
+void hold_located(test::held<void(located)>* slot, std::function<void(located)> f) {
+    slot->callback = std::move(f);
+}
+
+void test_awaitable() {
+    CHECK(async_wrapper(echo, 1, placeholder::awaitable).get() == 1);
+    CHECK(async_wrapper(echo_later, 2, placeholder::awaitable).get() == 2);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::awaitable), std::runtime_error);
+
+    run_loop loop;
+    CHECK(sync_wait(loop, [&loop]() -> awaitable_t<int> {
+              co_return co_await async_wrapper(echo_later, 3, placeholder::awaitable_on(loop)) +
+                  co_await async_wrapper(echo, 4, placeholder::awaitable_on(loop, placeholder::inline_if_running));
+          }()) == 7);
+
+    held_t slot;
+    stop_source source;
+    auto future = async_wrapper(hold, &slot, placeholder::with_stop_token(placeholder::awaitable, source.get_token()));
+    source.request_stop();
+    CHECK(test::error_of([&]() { future.get(); }) == std::errc::operation_canceled);
+    slot.callback(1);
+
+    CHECK(test::error_of([]() { async_wrapper(dropping, 1, placeholder::awaitable).get(); }) == broken);
+    auto dropped = async_wrapper(hold, &slot, placeholder::awaitable);
+    std::thread{[&slot]() { slot.callback = nullptr; }}.join();
+    CHECK(test::error_of([&]() { dropped.get(); }) == broken);
+    CHECK(async_wrapper(twice, 1, placeholder::awaitable).get() == 1);
+    CHECK_THROWS(async_wrapper(fire_then_throw, 1, placeholder::awaitable), std::runtime_error);
+}
+
+void test_sync_wait() {
+    // the callback completes the awaitable on another thread, sync_wait takes the result on the loop's
+    run_loop loop;
+    located::loop = &loop;
+    test::held<void(located)> slot;
+    auto pending = async_wrapper(hold_located, &slot, placeholder::awaitable);
+    loop.post([&slot]() { std::thread{[&slot]() { slot.callback(located{}); }}.join(); });
+    const auto result = sync_wait(loop, std::move(pending));
+    CHECK(std::find(result.moves.begin(), result.moves.end(), true) != result.moves.end());
+    located::loop = nullptr;
+
+    // a loop of its own is gone right after sync_wait, while the completing thread may be posting
+    for (int i = 0; i < 100; ++i) {
+        CHECK(sync_wait(async_wrapper(echo_later, i, placeholder::awaitable)) == i);
+    }
+    CHECK_THROWS(sync_wait([]() -> awaitable {
+                     co_await async_wrapper(echo_later, 1, placeholder::awaitable);
+                     throw std::runtime_error{"after"};
+                 }()),
+                 std::runtime_error);
+}
+
+void test_awaitable_st() {
+    run_loop loop;
+    held_t slot;
+    CHECK(sync_wait(loop, [&]() -> awaitable_t<int> {
+              const auto a = co_await async_wrapper(echo, 1, placeholder::awaitable_st);
+              auto pending = async_wrapper(hold, &slot, placeholder::awaitable_st);
+              loop.post([&slot]() { slot.callback(2); });
+              co_return a + co_await std::move(pending);
+          }()) == 3);
+    CHECK_THROWS(async_wrapper(throwing, 1, placeholder::awaitable_st), std::runtime_error);
+    CHECK(test::error_of([&]() {
+              sync_wait(loop, [&]() -> awaitable {
+                  auto pending = async_wrapper(hold, &slot, placeholder::awaitable_st);
+                  loop.post([&slot]() { slot.callback = nullptr; });
+                  co_await std::move(pending);
+              }());
+          }) == broken);
+    CHECK(sync_wait(loop, []() -> awaitable_t<int> {
+              co_return co_await async_wrapper(twice, 1, placeholder::awaitable_st);
+          }()) == 1);
+}
+
+void test_deferred() {
+    run_loop loop;
+    CHECK(sync_wait(loop, []() -> awaitable_t<int> {
+              co_return co_await async_wrapper(echo, 1, placeholder::deferred) +
+                  co_await async_wrapper(echo_later, 2, placeholder::deferred);
+          }()) == 3);
+    CHECK_THROWS(sync_wait(loop, async_wrapper(throwing, 1, placeholder::deferred)), std::runtime_error);
+}
+
+void test_stream() {
+    run_loop loop;
+    held_t slot;
+    CHECK(sync_wait(loop, [&]() -> awaitable_t<int> {
+              auto events = async_wrapper(hold, &slot, placeholder::stream);
+              loop.post([&slot]() {
+                  slot.callback(1);
+                  slot.callback(2);
+                  slot.callback = nullptr;
+              });
+              int sum{0};
+              int value;
+              while (co_await events.next(value)) {
+                  sum += value;
+              }
+              co_return sum;
+          }()) == 3);
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace
+
+int main() {
+    test_std_future();
+    test_timeout();
+    test_blocking();
+    test_continuable();
+    test_user_data();
+    test_as_expected();
+    test_limited();
+    test_bulk();
+#if defined(ENABLE_CO_AWAIT)
+    test_awaitable();
+    test_sync_wait();
+    test_awaitable_st();
+    test_deferred();
+    test_stream();
+#endif // defined(ENABLE_CO_AWAIT)
+#if defined(ENABLE_INSTRUMENTATION)
+    // dropped callbacks and throwing callees leave no call behind
+    CHECK(instrumentation::in_flight() == 0);
+#endif // defined(ENABLE_INSTRUMENTATION)
+    return test::report();
+}
@@ -0,0 +1,139 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// single_flight的合并、缓存、异常与丢弃回调
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <vector>
+
+#include <single_flight.hpp>
+
+#include "test.hpp"
+
+using namespace cue;
+
+namespace {
+
+// what func does with the callback of the next call
+enum class action { hold, fire, fire_twice, drop, throw_ };
+
+struct backend final {
+    void operator()(int key, std::function<void(int)> callback) {
+        ++calls;
+        switch (next) {
+        case action::hold:
+            held.push_back(std::move(callback));
+            break;
+        case action::fire:
+            callback(key);
+            break;
+        case action::fire_twice:
+            callback(key);
+            callback(key + 1);
+            break;
+        case action::drop:
+            break;
+        case action::throw_:
+            throw std::runtime_error{"backend"};
+        }
+    }
+
+    action next{action::hold};
+    int calls{0};
+    std::vector<std::function<void(int)>> held;
+};
+
+using flight_t = single_flight<std::function<void(int, std::function<void(int)>)>>;
+
+const auto broken = std::make_error_code(std::future_errc::broken_promise);
+
+void test_coalesce() {
+    backend callee;
+    flight_t flight{std::ref(callee)};
+    auto first = flight(1, placeholder::std_future);
+    auto second = flight(1, placeholder::continuable);
+    auto other = flight(2, placeholder::std_future);
+    CHECK(callee.calls == 2);
+    callee.held[0](10);
+    callee.held[1](20);
+    CHECK(first.get() == 10);
+    CHECK(second.get() == 10);
+    CHECK(other.get() == 20);
+    // landed, the next call goes to func again
+    callee.next = action::fire;
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+    CHECK(callee.calls == 3);
+}
+
+void test_cache() {
+    backend callee;
+    callee.next = action::fire;
+    flight_t flight{std::ref(callee), single_flight_options{4, std::chrono::hours{1}, 16}};
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+    CHECK(callee.calls == 1);
+}
+
+void test_throw() {
+    backend callee;
+    callee.next = action::throw_;
+    flight_t flight{std::ref(callee)};
+    CHECK_THROWS(flight(1, placeholder::std_future).get(), std::runtime_error);
+    callee.next = action::fire;
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+}
+
+void test_drop() {
+    backend callee;
+    flight_t flight{std::ref(callee)};
+    auto first = flight(1, placeholder::std_future);
+    auto second = flight(1, placeholder::blocking);
+    callee.held.clear();
+    CHECK(test::error_of([&]() { first.get(); }) == broken);
+    CHECK(test::error_of([&]() { second.get(); }) == broken);
+
+    // dropped within func, the key does not hang
+    callee.next = action::drop;
+    CHECK(test::error_of([&]() { flight(1, placeholder::std_future).get(); }) == broken);
+    callee.next = action::fire;
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+}
+
+void test_fire_twice() {
+    backend callee;
+    callee.next = action::fire_twice;
+    flight_t flight{std::ref(callee)};
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+    CHECK(flight(1, placeholder::std_future).get() == 1);
+    CHECK(callee.calls == 2);
+}
+
+} // namespace
+
+int main() {
+    test_coalesce();
+    test_cache();
+    test_throw();
+    test_drop();
+    test_fire_twice();
+    return test::report();
+}
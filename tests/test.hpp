@@ -0,0 +1,87 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ASYNC_WRAPPER_TEST_HPP_
+#define ASYNC_WRAPPER_TEST_HPP_
+
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <system_error>
+#include <utility>
+
+namespace test {
+
+inline int& failures() noexcept {
+    static int count{0};
+    return count;
+}
+
+inline void fail(const char* file, int line, const char* what) {
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+    ++failures();
+}
+
+// the exit code of a test executable
+inline int report() {
+    if (failures()) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures());
+        return 1;
+    }
+    return 0;
+}
+
+// the error code of the std::system_error or std::future_error func throws, empty if it throws nothing
+template <typename _Func>
+std::error_code error_of(_Func&& func) {
+    try {
+        std::forward<_Func>(func)();
+    } catch (const std::system_error& error) {
+        return error.code();
+    } catch (const std::future_error& error) {
+        return error.code();
+    }
+    return {};
+}
+
+// the callback a callee kept for the test to fire, or to drop, later
+template <typename _Signature>
+struct held final {
+    std::function<_Signature> callback;
+};
+
+} // namespace test
+
+// unlike assert also checked in release builds
+#define CHECK(condition) ((condition) ? (void)0 : ::test::fail(__FILE__, __LINE__, #condition))
+
+#define CHECK_THROWS(expression, exception)                                                                  \
+    do {                                                                                                     \
+        bool thrown{false};                                                                                  \
+        try {                                                                                                \
+            (void)(expression);                                                                              \
+        } catch (const exception&) {                                                                         \
+            thrown = true;                                                                                   \
+        }                                                                                                    \
+        if (!thrown) {                                                                                       \
+            ::test::fail(__FILE__, __LINE__, #expression " throws " #exception);                             \
+        }                                                                                                    \
+    } while (false)
+
+#endif // ASYNC_WRAPPER_TEST_HPP_
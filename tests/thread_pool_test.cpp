@@ -0,0 +1,82 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// thread_pool从外部与工作线程内投递任务，以及析构时运行剩余任务
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <thread_pool.hpp>
+
+#include "test.hpp"
+
+using namespace cue;
+
+namespace {
+
+void test_post() {
+    constexpr int posters{4};
+    constexpr int count{10000};
+    std::atomic_int done{0};
+    {
+        thread_pool pool{4};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < posters; ++i) {
+            threads.emplace_back([&]() {
+                for (int j = 0; j < count; ++j) {
+                    // every other task posts another one from its worker
+                    pool.post([&pool, &done, j]() {
+                        if (j % 2) {
+                            CHECK(pool.running_in_this_thread());
+                            pool.post([&done]() { ++done; });
+                        }
+                        ++done;
+                    });
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(done == posters * count * 3 / 2);
+}
+
+void test_wake() {
+    // a worker parked on an empty pool wakes for a single post
+    thread_pool pool{2};
+    for (int i = 0; i < 100; ++i) {
+        std::atomic_bool ran{false};
+        pool.post([&ran]() { ran.store(true); });
+        while (!ran.load()) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+}
+
+} // namespace
+
+int main() {
+    test_post();
+    test_wake();
+    return test::report();
+}
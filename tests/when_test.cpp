@@ -0,0 +1,104 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// when_all与when_any
+
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <async_wrapper.hpp>
+
+#include "test.hpp"
+
+using namespace cue;
+
+namespace {
+
+using held_t = test::held<void(int)>;
+
+void echo_later(int a, std::function<void(int)> f) {
+    std::thread{[=]() { f(a); }}.detach();
+}
+
+void hold(held_t* slot, std::function<void(int)> f) {
+    slot->callback = std::move(f);
+}
+
+void hold_read(test::held<void(std::error_code, int)>* slot, std::function<void(std::error_code, int)> f) {
+    slot->callback = std::move(f);
+}
+
+void read_later(int a, std::function<void(std::error_code, int)> f) {
+    std::thread{[=]() { f({}, a); }}.detach();
+}
+
+void test_std_future() {
+    auto all = when_all(async_wrapper(echo_later, 1, placeholder::std_future),
+                        async_wrapper(echo_later, 2, placeholder::std_future));
+    CHECK(std::get<0>(all) == 1 && std::get<1>(all) == 2);
+
+    held_t slot;
+    auto any = when_any(async_wrapper(hold, &slot, placeholder::std_future),
+                        async_wrapper(echo_later, 2, placeholder::std_future));
+    CHECK(any.index == 1 && any.value == 2);
+    slot.callback(1);
+
+    // decorated promises signal their completion as well
+    test::held<void(std::error_code, int)> read_slot;
+    std::vector<std::future<expected<int, std::error_code>>> expected_futures;
+    expected_futures.push_back(async_wrapper(hold_read, &read_slot, placeholder::as_expected(placeholder::std_future)));
+    expected_futures.push_back(async_wrapper(read_later, 3, placeholder::as_expected(placeholder::std_future)));
+    auto first = when_any(std::move(expected_futures));
+    CHECK(first.index == 1 && *first.value == 3);
+    read_slot.callback({}, 1);
+
+    CHECK_THROWS(when_any(std::vector<std::future<int>>{}), std::invalid_argument);
+}
+
+#if defined(ENABLE_CO_AWAIT)
+void test_awaitable() {
+    auto all = when_all(async_wrapper(echo_later, 1, placeholder::awaitable),
+                        async_wrapper(echo_later, 2, placeholder::awaitable))
+                   .get();
+    CHECK(std::get<0>(all) == 1 && std::get<1>(all) == 2);
+
+    held_t slot;
+    auto any = when_any(async_wrapper(hold, &slot, placeholder::awaitable),
+                        async_wrapper(echo_later, 2, placeholder::awaitable))
+                   .get();
+    CHECK(any.index == 1 && any.value == 2);
+    slot.callback(1);
+
+    CHECK_THROWS(when_any(std::vector<awaitable_future<int>>{}), std::invalid_argument);
+}
+#endif // defined(ENABLE_CO_AWAIT)
+
+} // namespace
+
+int main() {
+    test_std_future();
+#if defined(ENABLE_CO_AWAIT)
+    test_awaitable();
+#endif // defined(ENABLE_CO_AWAIT)
+    return test::report();
+}
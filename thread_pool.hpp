@@ -0,0 +1,387 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements. See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership. The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "async_wrapper.hpp"
+
+namespace cue {
+
+namespace detail {
+
+struct pool_task {
+    void (*run)(pool_task*);
+};
+
+template <typename _Func>
+struct pool_task_impl final : pool_task {
+    using allocator_type = recycling_allocator<pool_task_impl>;
+
+    static pool_task* create(_Func&& func) {
+        allocator_type allocator;
+        auto task = allocator.allocate(1);
+        try {
+            return ::new (static_cast<void*>(task)) pool_task_impl{std::move(func)};
+        } catch (...) {
+            allocator.deallocate(task, 1);
+            throw;
+        }
+    }
+
+    explicit pool_task_impl(_Func&& func) : pool_task{&invoke}, func_{std::move(func)} {
+    }
+
+    static void invoke(pool_task* task) {
+        auto self = static_cast<pool_task_impl*>(task);
+        auto func = std::move(self->func_);
+        self->~pool_task_impl();
+        allocator_type{}.deallocate(self, 1);
+        func();
+    }
+
+    _Func func_;
+};
+
+// a queued item is either the address of a coroutine frame, or a pool_task pointer tagged with 1
+using pool_item = std::uintptr_t;
+
+inline void run_pool_item(pool_item item) {
+    if (item & 1) {
+        auto task = reinterpret_cast<pool_task*>(item & ~pool_item{1});
+        task->run(task);
+    } else {
+#if defined(ENABLE_CO_AWAIT)
+        std::coroutine_handle<>::from_address(reinterpret_cast<void*>(item)).resume();
+#endif // defined(ENABLE_CO_AWAIT)
+    }
+}
+
+struct post_node final {
+    post_node* next;
+    pool_item item;
+};
+
+// intrusive lock free stack, take() returns everything pushed so far in posting order
+class post_queue final {
+public:
+    post_queue() noexcept = default;
+    post_queue(const post_queue&) = delete;
+    post_queue& operator=(const post_queue&) = delete;
+
+    bool push(post_node* node) noexcept {
+        auto head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while (!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    post_node* take() noexcept {
+        if (empty()) {
+            return nullptr;
+        }
+        auto node = head_.exchange(nullptr, std::memory_order_acquire);
+        post_node* batch{nullptr};
+        while (node) {
+            auto next = node->next;
+            node->next = batch;
+            batch = node;
+            node = next;
+        }
+        return batch;
+    }
+
+    bool empty() const noexcept {
+        return head_.load(std::memory_order_relaxed) == nullptr;
+    }
+
+private:
+    std::atomic<post_node*> head_{nullptr};
+};
+
+// Chase-Lev work stealing deque, grown arrays are kept until destruction because thieves may still read them
+class work_stealing_deque final {
+public:
+    explicit work_stealing_deque(std::size_t capacity = 256) : array_{new ring{capacity}} {
+        retired_.emplace_back(array_.load(std::memory_order_relaxed));
+    }
+
+    work_stealing_deque(const work_stealing_deque&) = delete;
+    work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+    void push(pool_item item) {
+        const auto bottom = bottom_.load(std::memory_order_relaxed);
+        const auto top = top_.load(std::memory_order_acquire);
+        auto array = array_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<std::int64_t>(array->capacity()) - 1) {
+            array = grow(array, bottom, top);
+        }
+        array->put(bottom, item);
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    bool pop(pool_item& item) noexcept {
+        const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        auto array = array_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = array->get(bottom);
+        if (top == bottom) {
+            // last item, race against thieves
+            const bool won =
+                top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool steal(pool_item& item) noexcept {
+        auto top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const auto bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return false;
+        }
+        item = array_.load(std::memory_order_acquire)->get(top);
+        return top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    bool empty() const noexcept {
+        return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+    }
+
+private:
+    class ring final {
+    public:
+        explicit ring(std::size_t capacity) : mask_{capacity - 1}, items_{new std::atomic<pool_item>[capacity]} {
+        }
+
+        std::size_t capacity() const noexcept {
+            return mask_ + 1;
+        }
+
+        pool_item get(std::int64_t index) const noexcept {
+            return items_[static_cast<std::size_t>(index) & mask_].load(std::memory_order_relaxed);
+        }
+
+        void put(std::int64_t index, pool_item item) noexcept {
+            items_[static_cast<std::size_t>(index) & mask_].store(item, std::memory_order_relaxed);
+        }
+
+    private:
+        std::size_t mask_;
+        std::unique_ptr<std::atomic<pool_item>[]> items_;
+    };
+
+    ring* grow(ring* array, std::int64_t bottom, std::int64_t top) {
+        std::unique_ptr<ring> bigger{new ring{array->capacity() * 2}};
+        for (auto i = top; i < bottom; ++i) {
+            bigger->put(i, array->get(i));
+        }
+        retired_.push_back(std::move(bigger));
+        array = retired_.back().get();
+        array_.store(array, std::memory_order_release);
+        return array;
+    }
+
+    std::atomic<std::int64_t> top_{0};
+    char padding_[64 - sizeof(std::atomic<std::int64_t>)];
+    std::atomic<std::int64_t> bottom_{0};
+    std::atomic<ring*> array_;
+    std::vector<std::unique_ptr<ring>> retired_;
+};
+
+} // namespace detail
+
+// work stealing pool, usable as executor for placeholder::awaitable_on
+class thread_pool final {
+public:
+    explicit thread_pool(std::size_t threads = std::thread::hardware_concurrency()) {
+        threads = threads ? threads : 1;
+        workers_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back(new worker{});
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_[i]->thread = std::thread{[this, i]() { run(i); }};
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool() {
+        stopped_.store(true, std::memory_order_seq_cst);
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        detail::atomic_notify_all(epoch_);
+        for (auto& worker : workers_) {
+            worker->thread.join();
+        }
+    }
+
+    template <typename _Func>
+    void post(_Func&& func) {
+        using task_t = detail::pool_task_impl<std::decay_t<_Func>>;
+        push(reinterpret_cast<detail::pool_item>(task_t::create(std::forward<_Func>(func))) | 1);
+    }
+
+#if defined(ENABLE_CO_AWAIT)
+    void post(std::coroutine_handle<> handle) {
+        push(reinterpret_cast<detail::pool_item>(handle.address()));
+    }
+#endif // defined(ENABLE_CO_AWAIT)
+
+    bool running_in_this_thread() const noexcept {
+        return current().pool == this;
+    }
+
+    std::size_t size() const noexcept {
+        return workers_.size();
+    }
+
+private:
+    struct worker final {
+        detail::work_stealing_deque deque;
+        std::thread thread;
+    };
+
+    struct context final {
+        const thread_pool* pool;
+        worker* self;
+    };
+
+    static context& current() noexcept {
+        static thread_local context ctx{nullptr, nullptr};
+        return ctx;
+    }
+
+    void push(detail::pool_item item) {
+        auto& ctx = current();
+        if (ctx.pool == this) {
+            ctx.self->deque.push(item);
+        } else {
+            auto node = recycling_allocator<detail::post_node>{}.allocate(1);
+            node->item = item;
+            injection_.push(node);
+        }
+        // pairs with the fence in park(), either we see the sleeper or it sees the item
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed)) {
+            epoch_.fetch_add(1, std::memory_order_release);
+            detail::atomic_notify_one(epoch_);
+        }
+    }
+
+    bool take(std::size_t index, detail::pool_item& item) {
+        auto& self = *workers_[index];
+        if (self.deque.pop(item)) {
+            return true;
+        }
+        if (auto node = injection_.take()) {
+            item = node->item;
+            while (auto next = node->next) {
+                recycling_allocator<detail::post_node>{}.deallocate(node, 1);
+                node = next;
+                self.deque.push(node->item);
+            }
+            recycling_allocator<detail::post_node>{}.deallocate(node, 1);
+            return true;
+        }
+        const auto count = workers_.size();
+        for (std::size_t i = 1; i < count; ++i) {
+            if (workers_[(index + i) % count]->deque.steal(item)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool has_work() {
+        if (!injection_.empty()) {
+            return true;
+        }
+        for (auto& worker : workers_) {
+            if (!worker->deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t index) {
+        current() = context{this, workers_[index].get()};
+        constexpr int spins{64};
+        detail::pool_item item;
+        for (;;) {
+            bool found{false};
+            for (int i = 0; i < spins && !found; ++i) {
+                found = take(index, item);
+            }
+            if (found) {
+                detail::run_pool_item(item);
+                continue;
+            }
+            if (!park()) {
+                break;
+            }
+        }
+        current() = context{nullptr, nullptr};
+    }
+
+    bool park() {
+        const auto epoch = epoch_.load(std::memory_order_acquire);
+        sleepers_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (has_work()) {
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        if (stopped_.load(std::memory_order_acquire)) {
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        detail::atomic_wait(epoch_, epoch);
+        sleepers_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    detail::post_queue injection_;
+    std::atomic<std::uint32_t> epoch_{0};
+    std::atomic<std::uint32_t> sleepers_{0};
+    std::atomic_bool stopped_{false};
+};
+
+} // namespace cue
+
+#endif // THREAD_POOL_HPP_